@@ -0,0 +1,123 @@
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+#include "Batch.hpp"
+#include "WorkerPool.hpp"
+
+/**
+ * ET_EXEC inputs opened so far. First job that needs given file
+ * loads it, others wait for the result (or for the same error).
+ **/
+class ExecCache {
+private:
+    using entry = std::shared_future<std::shared_ptr<const ExecInput>>;
+
+    std::mutex mutex;
+    std::map<std::string, entry> entries;
+
+public:
+    std::shared_ptr<const ExecInput> get(const std::string& fname) {
+        std::promise<std::shared_ptr<const ExecInput>> promise;
+        entry res;
+        bool loader = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(fname);
+            if (it == entries.end()) {
+                res = promise.get_future().share();
+                entries.emplace(fname, res);
+                loader = true;
+            } else {
+                res = it->second;
+            }
+        }
+        if (loader) {
+            try {
+                promise.set_value(std::make_shared<const ExecInput>(fname));
+            } catch (...) {
+                promise.set_exception(std::current_exception());
+            }
+        }
+        return res.get();
+    }
+};
+
+std::vector<LinkJob> read_manifest(const std::string& fname) {
+    std::ifstream in{fname};
+    if (!in)
+        throw "ERROR: Cannot open " + fname + "!";
+
+    std::vector<LinkJob> res;
+    std::string line;
+    for (size_t line_no = 1; std::getline(in, line); line_no++) {
+        std::istringstream ss(line);
+        std::vector<std::string> words;
+        for (std::string w; ss >> w; ) {
+            words.push_back(w);
+        }
+        if (words.empty() || words[0][0] == '#')
+            continue;
+        try {
+            res.push_back(parse_job(words));
+        } catch (const std::string& s) {
+            throw fname + ":" + std::to_string(line_no) + ": " + s;
+        }
+    }
+    return res;
+}
+
+size_t run_batch(const std::vector<LinkJob>& jobs, size_t num_threads) {
+    using clock = std::chrono::steady_clock;
+
+    ExecCache execs;
+    std::mutex out_mutex;
+    size_t failed = 0;
+
+    auto t0 = clock::now();
+    size_t pool_size;
+    {
+        WorkerPool pool(num_threads);
+        pool_size = pool.size();
+        for (const LinkJob& job : jobs) {
+            pool.submit([&execs, &out_mutex, &failed, &job]() {
+                auto start = clock::now();
+                std::string error;
+                LinkStats stats;
+                LinkStats* collect = job.options.stats != StatsFormat::none ? &stats : nullptr;
+                try {
+                    link(*execs.get(job.exec_fname), job, collect);
+                } catch (const std::string& s) {
+                    error = s;
+                } catch (const char * s) {
+                    error = s;
+                } catch (const std::exception& e) {
+                    error = e.what();
+                }
+                double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+                std::lock_guard<std::mutex> lock(out_mutex);
+                if (error.empty()) {
+                    std::cout << "[OK] " << job.out_fname << " (" << ms << " ms)\n";
+                    if (collect != nullptr) {
+                        stats.peak_rss_kb = peak_rss_kb(); // of whole batch so far
+                        std::cout << stats_report(job, stats, job.options.stats);
+                    }
+                } else {
+                    failed++;
+                    std::cout << "[FAIL] " << job.out_fname << ": " << error << "\n";
+                }
+            });
+        }
+        pool.wait();
+    }
+    double secs = std::chrono::duration<double>(clock::now() - t0).count();
+
+    std::cout << "[INFO] " << jobs.size() << " jobs (" << failed << " failed) on " << pool_size
+              << " threads in " << secs << " s: " << jobs.size() / secs << " jobs/s\n";
+    return failed;
+}
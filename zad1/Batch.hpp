@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Linker.hpp"
+
+/**
+ * Reads manifest of jobs - one per line, in the same form as postlinker arguments:
+ * <ET_EXEC file> <ET_REL file>... <target ET_EXEC file>
+ * Empty lines and lines starting with '#' are skipped.
+ * Throws std::string on error.
+ **/
+std::vector<LinkJob> read_manifest(const std::string& fname);
+
+/**
+ * Runs all jobs on WorkerPool of `num_threads` workers (0 - one per core).
+ * ET_EXEC shared by many jobs is opened and parsed only once.
+ * Prints outcome of every job and throughput summary,
+ * returns number of failed jobs.
+ **/
+size_t run_batch(const std::vector<LinkJob>& jobs, size_t num_threads);
@@ -0,0 +1,299 @@
+#include <cstring>
+
+#include "Detour.hpp"
+
+// operand kinds of one-byte opcodes
+enum : unsigned char {
+    BAD = 0, // unknown
+    NONE, // no operands in further bytes
+    MODRM,
+    MODRM_I8,
+    MODRM_I32, // imm16 with 0x66 prefix
+    I8,
+    I16,
+    I32, // imm16 with 0x66 prefix
+    MOV_IMM, // imm64 with REX.W
+    GROUP3, // f6/f7: imm only for /0 (test)
+    REL, // relative branch
+};
+
+static unsigned char one_byte_kind(unsigned char op) {
+    if (op < 0x40 && (op & 7) < 4)
+        return MODRM; // add, or, adc, sbb, and, sub, xor, cmp
+    if (op < 0x40 && (op & 7) == 4)
+        return I8;
+    if (op < 0x40 && (op & 7) == 5)
+        return I32;
+    if (op >= 0x50 && op <= 0x5f)
+        return NONE; // push, pop
+    if ((op >= 0x70 && op <= 0x7f) || (op >= 0xe0 && op <= 0xe3) || op == 0xe8 || op == 0xe9 || op == 0xeb)
+        return REL;
+    if (op >= 0xb0 && op <= 0xb7)
+        return I8;
+    if (op >= 0xb8 && op <= 0xbf)
+        return MOV_IMM;
+    if (op >= 0x90 && op <= 0x99)
+        return NONE; // nop, xchg, cwde, cdq
+    switch (op) {
+    case 0x63: case 0x84: case 0x85: case 0x86: case 0x87: case 0x88: case 0x89: case 0x8a: case 0x8b:
+    case 0x8d: case 0x8f: case 0xd0: case 0xd1: case 0xd2: case 0xd3: case 0xfe: case 0xff:
+        return MODRM;
+    case 0x6b: case 0x80: case 0x83: case 0xc0: case 0xc1: case 0xc6:
+        return MODRM_I8;
+    case 0x69: case 0x81: case 0xc7:
+        return MODRM_I32;
+    case 0x6a: case 0xa8:
+        return I8;
+    case 0x68: case 0xa9:
+        return I32;
+    case 0xc2:
+        return I16;
+    case 0xc3: case 0xc9: case 0xcc: case 0xf4: case 0xfc: case 0xfd:
+        return NONE;
+    case 0xf6: case 0xf7:
+        return GROUP3;
+    }
+    return BAD;
+}
+
+static unsigned char two_byte_kind(unsigned char op) {
+    if (op >= 0x80 && op <= 0x8f)
+        return REL; // jcc rel32
+    if ((op >= 0x10 && op <= 0x17) || (op >= 0x18 && op <= 0x1f) || (op >= 0x28 && op <= 0x2f)
+        || (op >= 0x40 && op <= 0x6f) || (op >= 0x74 && op <= 0x76) || (op >= 0x7e && op <= 0x7f)
+        || (op >= 0x90 && op <= 0x9f) || (op >= 0xd0 && op <= 0xfe))
+        return MODRM;
+    if (op >= 0xc8 && op <= 0xcf)
+        return NONE; // bswap
+    switch (op) {
+    case 0x05: case 0x0b: case 0xa2: case 0x31:
+        return NONE;
+    case 0xa3: case 0xab: case 0xaf: case 0xb0: case 0xb1: case 0xb3: case 0xb6: case 0xb7: case 0xbb:
+    case 0xbc: case 0xbd: case 0xbe: case 0xbf: case 0xc0: case 0xc1: case 0xc3: case 0xc7:
+        return MODRM;
+    case 0x70: case 0x71: case 0x72: case 0x73: case 0xa4: case 0xac: case 0xba: case 0xc2: case 0xc4:
+    case 0xc5: case 0xc6:
+        return MODRM_I8;
+    }
+    return BAD;
+}
+
+insn_info decode_insn(std::string_view code) {
+    // bytes past the end read as 0, such instruction is dropped at the end
+    auto byte = [&](size_t i) -> unsigned char {
+        return i < code.size() ? code[i] : 0;
+    };
+
+    insn_info res;
+    size_t i = 0;
+    bool opsize16 = false, rex_w = false;
+    for (; i < code.size(); i++) {
+        unsigned char b = byte(i);
+        if (b == 0x66)
+            opsize16 = true;
+        else if (!(b == 0x67 || b == 0xf0 || b == 0xf2 || b == 0xf3 || b == 0x2e || b == 0x3e
+                   || b == 0x26 || b == 0x36 || b == 0x64 || b == 0x65))
+            break;
+    }
+    // REX is the last prefix
+    if ((byte(i) & 0xf0) == 0x40) {
+        rex_w = byte(i) & 8;
+        i++;
+    }
+
+    unsigned char op = byte(i++);
+    unsigned char kind;
+    bool two_byte = op == 0x0f;
+    if (two_byte) {
+        op = byte(i++);
+        kind = two_byte_kind(op);
+    } else {
+        kind = one_byte_kind(op);
+    }
+    if (kind == BAD)
+        return res;
+
+    size_t imm32 = opsize16 ? 2 : 4;
+    if (kind == REL) {
+        res.branch = true;
+        // jcc rel32 and call/jmp rel32, the rest has rel8
+        res.rel_size = two_byte || op == 0xe8 || op == 0xe9 ? imm32 : 1;
+        i += res.rel_size;
+    } else if (kind == MODRM || kind == MODRM_I8 || kind == MODRM_I32 || kind == GROUP3) {
+        unsigned char modrm = byte(i++);
+        unsigned mod = modrm >> 6, rm = modrm & 7;
+        if (mod == 0 && rm == 5) {
+            res.rip_relative = true;
+            i += 4;
+        }
+        if (mod != 3 && rm == 4) {
+            unsigned char sib = byte(i++);
+            if (mod == 0 && (sib & 7) == 5)
+                i += 4;
+        }
+        i += mod == 1 ? 1 : mod == 2 ? 4 : 0;
+        if (kind == MODRM_I8)
+            i += 1;
+        else if (kind == MODRM_I32)
+            i += imm32;
+        else if (kind == GROUP3 && ((modrm >> 3) & 7) < 2) // test
+            i += op == 0xf6 ? 1 : imm32;
+    } else if (kind == I8) {
+        i += 1;
+    } else if (kind == I16) {
+        i += 2;
+    } else if (kind == I32) {
+        i += imm32;
+    } else if (kind == MOV_IMM) {
+        i += rex_w ? 8 : imm32;
+    }
+    if (i <= code.size())
+        res.length = i;
+    return res;
+}
+
+size_t insn_length(std::string_view code) {
+    insn_info insn = decode_insn(code);
+    if (insn.length == 0)
+        throw std::string("unknown instruction, or one ending past function");
+    if (insn.branch)
+        throw std::string("relative branch");
+    if (insn.rip_relative)
+        throw std::string("RIP-relative operand");
+    return insn.length;
+}
+
+size_t displaced_length(std::string_view code, size_t min) {
+    size_t len = 0;
+    while (len < min)
+        len += insn_length(code.substr(len));
+    return len;
+}
+
+int64_t branch_target(std::string_view code, size_t off, const insn_info& insn) {
+    const char* disp = code.data() + off + insn.length - insn.rel_size;
+    int64_t rel;
+    if (insn.rel_size == 1) {
+        rel = (int8_t) disp[0];
+    } else if (insn.rel_size == 2) {
+        int16_t rel16;
+        memcpy(&rel16, disp, sizeof(rel16));
+        rel = rel16;
+    } else {
+        int32_t rel32;
+        memcpy(&rel32, disp, sizeof(rel32));
+        rel = rel32;
+    }
+    return (int64_t) (off + insn.length) + rel;
+}
+
+static void put(std::string& out, const void* data, size_t n) {
+    out.append((const char*) data, n);
+}
+
+std::string trampoline_object(const std::vector<trampoline>& tramps) {
+    // .text.detour: each trampoline 16-aligned, prologue and `jmp rel32` back
+    std::string text;
+    std::vector<size_t> offs;
+    for (const trampoline& t : tramps) {
+        text.resize((text.size() + 15) / 16 * 16, '\xcc');
+        offs.push_back(text.size());
+        text += t.prologue;
+        text += std::string("\xe9\0\0\0\0", DETOUR_JUMP_SIZE);
+    }
+
+    // absolute symbols (original functions) are local, so they go first
+    std::string strtab(1, '\0');
+    std::vector<Elf64_Sym> syms(1 + 2 * tramps.size());
+    std::vector<Elf64_Rela> relas;
+    for (size_t t = 0; t < tramps.size(); t++) {
+        Elf64_Sym& orig = syms[1 + t];
+        orig.st_name = strtab.size();
+        strtab += tramps[t].name + '\0';
+        orig.st_info = ELF64_ST_INFO(STB_LOCAL, STT_FUNC);
+        orig.st_shndx = SHN_ABS;
+        orig.st_value = tramps[t].vaddr;
+
+        Elf64_Sym& label = syms[1 + tramps.size() + t];
+        label.st_name = strtab.size();
+        strtab += "orig_" + tramps[t].name + '\0';
+        label.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+        label.st_shndx = 1;
+        label.st_value = offs[t];
+        label.st_size = tramps[t].prologue.size() + DETOUR_JUMP_SIZE;
+
+        // jump lands behind displaced prologue
+        Elf64_Rela r{};
+        r.r_offset = offs[t] + tramps[t].prologue.size() + 1;
+        r.r_info = ELF64_R_INFO(1 + t, R_X86_64_PC32);
+        r.r_addend = (int64_t) tramps[t].prologue.size() - 4;
+        relas.push_back(r);
+    }
+
+    const char shstrtab[] = "\0.text.detour\0.symtab\0.strtab\0.rela.text.detour\0.shstrtab";
+    Elf64_Shdr shdrs[6] = {};
+    size_t off = sizeof(Elf64_Ehdr);
+    auto section = [&](size_t idx, size_t name, Elf64_Word type, size_t size, size_t align) {
+        off = (off + align - 1) / align * align;
+        shdrs[idx].sh_name = name;
+        shdrs[idx].sh_type = type;
+        shdrs[idx].sh_offset = off;
+        shdrs[idx].sh_size = size;
+        shdrs[idx].sh_addralign = align;
+        off += size;
+    };
+    section(1, 1, SHT_PROGBITS, text.size(), 16);
+    shdrs[1].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+    section(2, 14, SHT_SYMTAB, syms.size() * sizeof(Elf64_Sym), 8);
+    shdrs[2].sh_link = 3;
+    shdrs[2].sh_info = 1 + tramps.size();
+    shdrs[2].sh_entsize = sizeof(Elf64_Sym);
+    section(3, 22, SHT_STRTAB, strtab.size(), 1);
+    section(4, 30, SHT_RELA, relas.size() * sizeof(Elf64_Rela), 8);
+    shdrs[4].sh_flags = SHF_INFO_LINK;
+    shdrs[4].sh_link = 2;
+    shdrs[4].sh_info = 1;
+    shdrs[4].sh_entsize = sizeof(Elf64_Rela);
+    section(5, 49, SHT_STRTAB, sizeof(shstrtab), 1);
+    off = (off + 7) / 8 * 8;
+
+    Elf64_Ehdr ehdr{};
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_type = ET_REL;
+    ehdr.e_machine = EM_X86_64;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr.e_shentsize = sizeof(Elf64_Shdr);
+    ehdr.e_shoff = off;
+    ehdr.e_shnum = 6;
+    ehdr.e_shstrndx = 5;
+
+    std::string res;
+    put(res, &ehdr, sizeof(ehdr));
+    auto place = [&](size_t idx, const void* data) {
+        res.resize(shdrs[idx].sh_offset, '\0');
+        put(res, data, shdrs[idx].sh_size);
+    };
+    place(1, text.data());
+    place(2, syms.data());
+    place(3, strtab.data());
+    place(4, relas.data());
+    place(5, shstrtab);
+    res.resize(off, '\0');
+    put(res, shdrs, sizeof(shdrs));
+    return res;
+}
+
+std::string detour_jump(Elf64_Addr from, Elf64_Addr to, size_t size) {
+    int64_t rel = (int64_t) (to - (from + DETOUR_JUMP_SIZE));
+    if (rel != (int32_t) rel)
+        throw std::string("detour target out of jmp rel32 reach");
+    int32_t rel32 = rel;
+    std::string res("\xe9", 1);
+    put(res, &rel32, sizeof(rel32));
+    res.resize(size, '\xcc');
+    return res;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <elf.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * `--detour=EXEC=REL` or `--wrap=EXEC=REL`: ET_EXEC's function `exec_sym` starts
+ * with a jump to `rel_sym` of ET_RELs.
+ **/
+struct detour_spec {
+    std::string exec_sym;
+    std::string rel_sym;
+    bool wrap = false; // original stays callable as `orig_<exec_sym>`, through trampoline
+};
+
+/**
+ * Bytes of `jmp rel32` written at entry of detoured function.
+ **/
+const size_t DETOUR_JUMP_SIZE = 5;
+
+/**
+ * x86-64 instruction at the beginning of some code, as far as `decode_insn` tells.
+ **/
+struct insn_info {
+    size_t length = 0; // 0 if unknown or not whole in the code
+    bool branch = false; // relative: jcc, jmp, call, loop - displacement ends it
+    size_t rel_size = 0; // bytes of branch displacement
+    bool rip_relative = false; // operand addressed relative to next instruction
+};
+
+/**
+ * Decodes instruction at the beginning of `code`. Only common instructions are
+ * known: no VEX, no 3-byte opcodes.
+ **/
+insn_info decode_insn(std::string_view code);
+
+/**
+ * Length of x86-64 instruction at the beginning of `code`. Throws std::string if
+ * `decode_insn` doesn't know it, or if it's relative (branch, RIP-relative
+ * operand) - it wouldn't work moved elsewhere.
+ **/
+size_t insn_length(std::string_view code);
+
+/**
+ * Length of whole instructions at the beginning of `code` covering at least
+ * `min` bytes, all of them movable (see `insn_length`). Throws std::string if
+ * `code` ends before.
+ **/
+size_t displaced_length(std::string_view code, size_t min);
+
+/**
+ * Offset (from start of `code`) branch `insn` at `off` goes to.
+ **/
+int64_t branch_target(std::string_view code, size_t off, const insn_info& insn);
+
+/**
+ * Wrapped function: its `prologue` gets executed in trampoline, which then
+ * jumps to `vaddr` + prologue size.
+ **/
+struct trampoline {
+    std::string name;
+    Elf64_Addr vaddr;
+    std::string prologue;
+};
+
+/**
+ * In-memory ET_REL with section `.text.detour` holding trampolines of `tramps`,
+ * each one labeled by global `orig_<name>`. Jumps back are relocations against
+ * absolute symbols, so that they are applied as any other.
+ **/
+std::string trampoline_object(const std::vector<trampoline>& tramps);
+
+/**
+ * `jmp rel32` placed at `from` to `to`, padded with int3 to `size` bytes.
+ * Throws std::string if `to` is out of reach.
+ **/
+std::string detour_jump(Elf64_Addr from, Elf64_Addr to, size_t size);
@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "ElfImage.hpp"
+#include "SectionEditor.hpp"
+#include "Utils.hpp"
+
+typedef SectionEditor SE;
+
+ElfImage::ElfImage(std::string content) : storage(std::move(content)) {
+    parse();
+}
+
+ElfImage::ElfImage(std::string_view content) : storage(content) {
+    parse();
+}
+
+void ElfImage::parse() {
+    ehdr = get_elf_header(read(0, sizeof(Elf64_Ehdr)));
+    parse_shdrs();
+    parse_phdrs();
+}
+
+void ElfImage::parse_shdrs() {
+    std::string_view tbl = read(ehdr.e_shoff, ehdr.e_shnum * ehdr.e_shentsize);
+    sections.assign(ehdr.e_shnum, section_descr{});
+    for (size_t i = 0; i < sections.size(); i++) {
+        std::memcpy(&sections[i].first, &tbl[i * ehdr.e_shentsize], sizeof(Elf64_Shdr));
+    }
+
+    name_idx.clear();
+    dup_name_idx.clear();
+    name_idx.reserve(sections.size());
+    for (size_t i = 0; i < sections.size(); i++) {
+        sections[i].second = std::string(name_at(sections[i].first.sh_name));
+        index_name(i);
+    }
+}
+
+void ElfImage::parse_phdrs() {
+    std::string_view tbl = read(ehdr.e_phoff, ehdr.e_phnum * ehdr.e_phentsize);
+    phdrs.assign(ehdr.e_phnum, Elf64_Phdr{});
+    for (size_t i = 0; i < phdrs.size(); i++) {
+        std::memcpy(&phdrs[i], &tbl[i * ehdr.e_phentsize], sizeof(Elf64_Phdr));
+    }
+}
+
+std::string_view ElfImage::name_at(Elf64_Word sh_name) const {
+    const Elf64_Shdr& shstrtab = sections[ehdr.e_shstrndx].first;
+    std::string_view res = read(shstrtab.sh_offset, shstrtab.sh_size).substr(sh_name);
+    return res.substr(0, res.find('\0')); // to first null char
+}
+
+// index keeps first section of given name, same as SE::find_section_idx;
+// the rest wait in dup_name_idx, so renaming the first needs no rescan
+void ElfImage::index_name(size_t idx) {
+    const std::string& name = sections[idx].second;
+    auto pair = name_idx.emplace(name, idx);
+    if (pair.second)
+        return;
+    size_t& first = pair.first->second;
+    dup_name_idx[name].insert(std::max(first, idx));
+    first = std::min(first, idx);
+}
+
+void ElfImage::unindex_name(size_t idx) {
+    const std::string& name = sections[idx].second;
+    auto it = name_idx.find(name);
+    if (it == name_idx.end())
+        return;
+    auto dup = dup_name_idx.find(name);
+    if (it->second == idx) {
+        if (dup == dup_name_idx.end()) {
+            name_idx.erase(it);
+            return;
+        }
+        it->second = *dup->second.begin();
+        dup->second.erase(dup->second.begin());
+    } else if (dup != dup_name_idx.end()) {
+        dup->second.erase(idx);
+    }
+    if (dup != dup_name_idx.end() && dup->second.empty())
+        dup_name_idx.erase(dup);
+}
+
+bool ElfImage::has_section(const std::string& name) const {
+    return name_idx.count(name) != 0;
+}
+
+size_t ElfImage::section_idx(const std::string& name) const {
+    auto it = name_idx.find(name);
+    if (it == name_idx.end())
+        throw ("find_section: Cannot find section " + name + "\n");
+    return it->second;
+}
+
+const Elf64_Shdr& ElfImage::section(const std::string& name) const {
+    return sections[section_idx(name)].first;
+}
+
+std::string_view ElfImage::section_content(const Elf64_Shdr& hdr) const {
+    return read(hdr.sh_offset, hdr.sh_size);
+}
+
+std::string_view ElfImage::section_content(const std::string& name) const {
+    return section_content(section(name));
+}
+
+void ElfImage::set_header(const Elf64_Ehdr& h) {
+    storage.write(0, &h, sizeof(Elf64_Ehdr));
+    ehdr = h;
+}
+
+void ElfImage::set_shdr(size_t idx, const Elf64_Shdr& hdr) {
+    assert(idx < sections.size());
+    storage.write(SE::get_sh_offset(ehdr, idx), &hdr, ehdr.e_shentsize);
+    sections[idx].first = hdr;
+
+    std::string_view name = name_at(hdr.sh_name);
+    if (name != sections[idx].second) {
+        unindex_name(idx);
+        sections[idx].second = std::string(name);
+        index_name(idx);
+    }
+}
+
+void ElfImage::push_shdr(const Elf64_Shdr& hdr) {
+    assert(SE::get_sh_offset(ehdr, ehdr.e_shnum) == size());
+
+    storage.append(std::string_view((const char*) &hdr, ehdr.e_shentsize));
+    Elf64_Ehdr h = ehdr;
+    h.e_shnum++;
+    set_header(h);
+
+    sections.push_back(std::make_pair(hdr, std::string(name_at(hdr.sh_name))));
+    index_name(sections.size() - 1);
+}
+
+void ElfImage::reset_shdrs(size_t off, const std::vector<Elf64_Shdr>& tbl) {
+    storage.truncate(off);
+    std::string buf;
+    for (const Elf64_Shdr& hdr : tbl) {
+        buf.append((const char*) &hdr, sizeof(Elf64_Shdr));
+        buf.resize(buf.size() + ehdr.e_shentsize - sizeof(Elf64_Shdr), '\0');
+    }
+    storage.append(std::move(buf));
+
+    Elf64_Ehdr h = ehdr;
+    h.e_shoff = off;
+    h.e_shnum = tbl.size();
+    set_header(h);
+    parse_shdrs();
+}
+
+void ElfImage::set_phdr(size_t idx, const Elf64_Phdr& ph) {
+    assert(idx < phdrs.size());
+    storage.write(ehdr.e_phoff + idx * ehdr.e_phentsize, &ph, sizeof(Elf64_Phdr));
+    phdrs[idx] = ph;
+}
+
+void ElfImage::move_phdrs(const std::vector<Elf64_Phdr>& tbl, size_t off) {
+    assert(off >= size());
+    storage.append_zeros(off - size());
+
+    std::string buf;
+    for (const Elf64_Phdr& ph : tbl) {
+        buf.append((const char*) &ph, sizeof(Elf64_Phdr));
+        buf.resize(buf.size() + ehdr.e_phentsize - sizeof(Elf64_Phdr), '\0');
+    }
+    storage.append(std::move(buf));
+
+    Elf64_Ehdr h = ehdr;
+    h.e_phoff = off;
+    h.e_phnum = tbl.size();
+    set_header(h);
+    phdrs = tbl;
+}
+
+void ElfImage::prepend(std::string buf, size_t size) {
+    storage.prepend(std::move(buf), size);
+    ehdr = get_elf_header(read(0, sizeof(Elf64_Ehdr)));
+    parse_phdrs();
+
+    // names don't change, so index stays valid
+    for (size_t i = 0; i < sections.size(); i++) {
+        Elf64_Shdr& hdr = sections[i].first;
+        hdr.sh_offset += size;
+        storage.write(SE::get_sh_offset(ehdr, i), &hdr, ehdr.e_shentsize);
+    }
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <elf.h>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "PieceTable.hpp"
+
+using section_descr = std::pair<Elf64_Shdr, std::string> ;
+
+/**
+ * ELF file with parsed ELF header, section header table and program header table.
+ * Tables are read once, lookups by section name go through hash index.
+ * Methods that change tables (set_header, set_shdr, push_shdr, prepend) keep
+ * parsed state in sync incrementally, without rescanning whole file.
+ *
+ * Content is kept in PieceTable - image built on read-only bytes (e.g. file
+ * mapped by ElfView) views them, modifications copy only changed ranges.
+ **/
+class ElfImage {
+private:
+    PieceTable storage;
+
+    Elf64_Ehdr ehdr;
+    std::vector<section_descr> sections;
+    std::vector<Elf64_Phdr> phdrs;
+    std::unordered_map<std::string, size_t> name_idx;
+    std::unordered_map<std::string, std::set<size_t>> dup_name_idx; // other sections of names in name_idx
+
+    std::string_view name_at(Elf64_Word sh_name) const;
+
+    void index_name(size_t idx);
+
+    void unindex_name(size_t idx);
+
+    void parse_phdrs();
+
+    void parse_shdrs();
+
+    void parse();
+
+public:
+    explicit ElfImage(std::string content);
+
+    /**
+     * Views `content`, which must outlive image and all its copies.
+     **/
+    explicit ElfImage(std::string_view content);
+
+    // copy shares only external bytes, so it's cheap for image of mapped file
+    ElfImage(const ElfImage&) = default;
+    ElfImage(ElfImage&&) = default;
+
+    const PieceTable& content() const { return storage; }
+
+    size_t size() const { return storage.size(); }
+
+    /**
+     * See PieceTable::read - range must be stored contiguously.
+     **/
+    std::string_view read(size_t off, size_t n) const { return storage.read(off, n); }
+
+    std::string copy(size_t off, size_t n) const { return storage.copy(off, n); }
+
+    /**
+     * Raw write - must not touch ELF header, nor section or program
+     * header tables (use methods below for these).
+     **/
+    void write(size_t off, const void* src, size_t n) { storage.write(off, src, n); }
+
+    void zero(size_t off, size_t n) { storage.zero(off, n); }
+
+    void append(std::string_view bytes) { storage.append(bytes); }
+
+    void append(std::string&& bytes) { storage.append(std::move(bytes)); }
+
+    void append_zeros(size_t n) { storage.append_zeros(n); }
+
+    /**
+     * Cuts file to `n` bytes - must not cut ELF header, nor tables.
+     **/
+    void truncate(size_t n) { storage.truncate(n); }
+
+    const Elf64_Ehdr& header() const { return ehdr; }
+
+    const std::vector<section_descr>& shdrs() const { return sections; }
+
+    const std::vector<Elf64_Phdr>& phs() const { return phdrs; }
+
+    bool has_section(const std::string& name) const;
+
+    size_t section_idx(const std::string& name) const;
+
+    const Elf64_Shdr& section(const std::string& name) const;
+
+    std::string_view section_content(const Elf64_Shdr& hdr) const;
+
+    std::string_view section_content(const std::string& name) const;
+
+    void set_header(const Elf64_Ehdr& h);
+
+    /**
+     * Overwrites `idx` entry of section header table.
+     * Name is taken from current .shstrtab.
+     **/
+    void set_shdr(size_t idx, const Elf64_Shdr& hdr);
+
+    /**
+     * Appends entry to section header table, which must be at the very end of file.
+     * Updates e_shnum.
+     **/
+    void push_shdr(const Elf64_Shdr& hdr);
+
+    /**
+     * Cuts file to `off` bytes and writes `tbl` there as new section header table
+     * (at the very end of file). Names are read from .shstrtab given by `tbl`,
+     * which must lie before `off`. Updates e_shoff and e_shnum.
+     **/
+    void reset_shdrs(size_t off, const std::vector<Elf64_Shdr>& tbl);
+
+    /**
+     * Overwrites `idx` entry of program header table.
+     **/
+    void set_phdr(size_t idx, const Elf64_Phdr& ph);
+
+    /**
+     * Writes `tbl` as new program header table at `off`, which must not be
+     * before the end of file (gap becomes hole). Updates e_phoff and e_phnum,
+     * old table stays where it was.
+     **/
+    void move_phdrs(const std::vector<Elf64_Phdr>& tbl, size_t off);
+
+    /**
+     * Inserts `buf` padded with zeros to `size` bytes at the very beginning
+     * of file and shifts offsets of all sections by `size`. `buf` must contain
+     * new ELF header (with e_shoff already shifted) and program header table.
+     **/
+    void prepend(std::string buf, size_t size);
+};
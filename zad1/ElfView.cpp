@@ -0,0 +1,53 @@
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ElfView.hpp"
+
+ElfView::ElfView(const std::string& path, int advice) {
+    int fd = open(path.data(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw path.data();
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        throw path.data();
+    }
+
+    void* res = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (res == MAP_FAILED) {
+        close(fd);
+        throw path.data();
+    }
+
+    file = fd; // kept open for cloning into output
+    addr = (const char*) res;
+    len = st.st_size;
+    madvise(res, len, advice);
+}
+
+ElfView::ElfView(ElfView&& other) noexcept : file(other.file), addr(other.addr), len(other.len) {
+    other.file = -1;
+    other.addr = nullptr;
+    other.len = 0;
+}
+
+ElfView::~ElfView() {
+    if (addr != nullptr)
+        munmap((void*) addr, len);
+    if (file >= 0)
+        close(file);
+}
+
+void ElfView::advise(size_t off, size_t n, int advice) const {
+    // madvise requires page aligned beginning
+    size_t page = getpagesize();
+    size_t begin = off - off % page;
+    if (begin >= len)
+        return;
+    n = std::min(n + (off - begin), len - begin);
+    madvise((void*) (addr + begin), n, advice);
+}
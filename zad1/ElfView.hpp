@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+
+/**
+ * Read-only view of ELF file mapped into memory.
+ * No file content is copied - readers that take `std::string_view`
+ * (get_elf_header, get_phs, SE::get_shdrs, get_symbols...) can work
+ * on it directly.
+ **/
+class ElfView {
+private:
+    int file = -1;
+    const char* addr = nullptr;
+    size_t len = 0;
+
+public:
+    /**
+     * Maps whole `path` file and passes `advice` to madvise.
+     * Throws `path` on failure (same as unreadable/empty input).
+     **/
+    explicit ElfView(const std::string& path, int advice = MADV_WILLNEED);
+
+    ElfView(ElfView&& other) noexcept;
+    ElfView(const ElfView&) = delete;
+    ElfView& operator=(const ElfView&) = delete;
+    ~ElfView();
+
+    const char* data() const { return addr; }
+
+    /**
+     * Descriptor of mapped file (read-only), e.g. for FICLONE or copy_file_range.
+     **/
+    int fd() const { return file; }
+
+    size_t size() const { return len; }
+
+    std::string_view view() const { return std::string_view(addr, len); }
+
+    operator std::string_view() const { return view(); }
+
+    /**
+     * Hints kernel how [off, off + n) range will be accessed,
+     * e.g. MADV_SEQUENTIAL before copying big chunk of file.
+     **/
+    void advise(size_t off, size_t n, int advice) const;
+};
@@ -0,0 +1,335 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+#include "FileWriter.hpp"
+#include "Stats.hpp"
+
+static const mode_t OUTPUT_MODE = 0755;
+
+static std::string write_error(const std::string& path) {
+    return "ERROR: Cannot write " + path + ": " + strerror(errno);
+}
+
+static std::string dir_of(const std::string& path) {
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos)
+        return ".";
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+// unique among threads and processes writing to the same directory
+static std::string temp_name(const std::string& path) {
+    static std::atomic<unsigned> counter{0};
+    return path + ".tmp" + std::to_string(getpid()) + "." + std::to_string(counter++);
+}
+
+/**
+ * Writes all of `iov` at `off`, resuming after partial writes.
+ * Returns false with errno set on failure.
+ **/
+static bool pwrite_all(int fd, iovec* iov, size_t cnt, off_t off) {
+    while (cnt > 0) {
+        ssize_t w = pwritev(fd, iov, std::min<size_t>(cnt, IOV_MAX), off);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0) {
+            if (w == 0)
+                errno = EIO;
+            return false;
+        }
+        off += w;
+        count_written(w);
+        while (cnt > 0 && (size_t) w >= iov->iov_len) {
+            w -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char*) iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+    return true;
+}
+
+static bool write_zeros(int fd, size_t off, size_t n) {
+    static const char zeros[1 << 16] = {};
+    while (n > 0) {
+        iovec iov{(void*) zeros, std::min(n, sizeof(zeros))};
+        if (!pwrite_all(fd, &iov, 1, off))
+            return false;
+        off += iov.iov_len;
+        n -= iov.iov_len;
+    }
+    return true;
+}
+
+// makes [off, off + n) of `fd` read as zeros
+static bool clear(int fd, size_t off, size_t n) {
+    return n == 0 || fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, n) == 0
+        || write_zeros(fd, off, n);
+}
+
+/**
+ * Copies [src_off, src_off + n) of `src` to `dst_off` of `dst` without
+ * mapping it - copy_file_range, or pread/pwrite through small buffer when
+ * kernel can't copy between these files. Holes of `src` are skipped, so
+ * destination range must read as zeros already (and stays sparse).
+ * Returns false with errno set on failure.
+ **/
+static bool copy_range(int dst, int src, size_t src_off, size_t dst_off, size_t n) {
+    static const size_t CHUNK = 1 << 20;
+    std::vector<char> buf;
+    const size_t end = src_off + n;
+    size_t pos = src_off;
+    while (pos < end) {
+        // next extent with data
+        off_t data = lseek(src, pos, SEEK_DATA);
+        if (data < 0 && errno == ENXIO)
+            return true;
+        off_t hole = data < 0 ? -1 : lseek(src, data, SEEK_HOLE);
+        if (data < 0 || hole < 0) {
+            // no SEEK_DATA support - all of it is data
+            data = pos;
+            hole = end;
+        }
+        pos = data;
+        size_t stop = std::min<size_t>(hole, end);
+
+        while (pos < stop) {
+            loff_t in = pos, out = dst_off + (pos - src_off);
+            ssize_t w;
+            if (buf.empty()) {
+                w = copy_file_range(src, &in, dst, &out, stop - pos, 0);
+                if (w < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+                    buf.resize(CHUNK);
+                    continue;
+                }
+                count_copied_in_kernel(std::max<ssize_t>(w, 0));
+            } else {
+                w = pread(src, buf.data(), std::min(CHUNK, stop - pos), pos);
+                count_copied(std::max<ssize_t>(w, 0));
+                iovec iov{buf.data(), w > 0 ? (size_t) w : 0};
+                if (w > 0 && !pwrite_all(dst, &iov, 1, out))
+                    return false;
+            }
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w <= 0) {
+                if (w == 0)
+                    errno = EIO;
+                return false;
+            }
+            pos += w;
+        }
+    }
+    return true;
+}
+
+// offset in `base` of bytes viewed by `p`, or npos if it views something else
+static size_t base_offset(const PieceTable::Piece& p, const ElfView* base) {
+    if (base == nullptr || p.ext == nullptr || p.ext < base->data()
+        || p.ext + p.len > base->data() + base->size())
+        return std::string::npos;
+    return p.ext - base->data();
+}
+
+/**
+ * Sets mode and size of `fd` file, then writes stored pieces - every run of
+ * adjacent ones with single pwritev. Holes are never written, ftruncate
+ * leaves them sparse.
+ *
+ * Pieces viewing `base` are copied from its file instead, so they are never
+ * read through mapping - memory use doesn't depend on ET_EXEC size.
+ * If `cloned`, file already holds copy of `base`: pieces that view it at
+ * their own offsets are skipped and everything else over it is cleared first.
+ *
+ * Returns false with errno set on failure.
+ **/
+static bool fill(int fd, const PieceTable& content, const ElfView* base, bool cloned) {
+    // explicit fchmod, so umask doesn't matter (as with `chmod 755` before)
+    if (fchmod(fd, OUTPUT_MODE) != 0 || ftruncate(fd, content.size()) != 0)
+        return false;
+
+    const size_t cloned_end = cloned ? std::min(base->size(), content.size()) : 0;
+    auto clear_cloned = [&](const PieceTable::Piece& p) {
+        return p.off >= cloned_end || clear(fd, p.off, std::min(p.end(), cloned_end) - p.off);
+    };
+
+    const auto& pieces = content.all();
+    std::vector<iovec> iov;
+    size_t i = 0;
+    while (i < pieces.size()) {
+        const auto& p = pieces[i];
+        size_t src = base_offset(p, base);
+        if (p.is_hole() || src != std::string::npos) {
+            i++;
+            if (cloned && src == p.off)
+                continue;
+            if (!clear_cloned(p))
+                return false;
+            if (src != std::string::npos && !copy_range(fd, base->fd(), src, p.off, p.len))
+                return false;
+            continue;
+        }
+
+        size_t off = p.off;
+        iov.clear();
+        for (; i < pieces.size() && !pieces[i].is_hole() && base_offset(pieces[i], base) == std::string::npos; i++) {
+            if (!clear_cloned(pieces[i]))
+                return false;
+            iov.push_back(iovec{(void*) pieces[i].data(), pieces[i].len});
+        }
+        if (!pwrite_all(fd, iov.data(), iov.size(), off))
+            return false;
+    }
+    return true;
+}
+
+static bool worth_cloning(const PieceTable& content, const ElfView& base) {
+    size_t shared = 0;
+    for (const auto& p : content.all()) {
+        if (base_offset(p, &base) == p.off)
+            shared += p.len;
+    }
+    return shared >= base.size() / 2;
+}
+
+// FICLONE shares extents (btrfs, XFS), otherwise bytes are copied in kernel
+static bool clone(int fd, const ElfView& base) {
+    if (ioctl(fd, FICLONE, base.fd()) == 0) {
+        count_cloned(base.size());
+        return true;
+    }
+    return copy_range(fd, base.fd(), 0, 0, base.size());
+}
+
+/**
+ * Writes `content` to new file `fd`. If most of `base` stays in place,
+ * file is cloned from it first (when allowed), so only the delta is written.
+ **/
+static bool fill_from(int fd, const PieceTable& content, const ElfView* base, bool allow_clone) {
+    bool cloned = allow_clone && base != nullptr && worth_cloning(content, *base);
+    if (cloned && !clone(fd, *base)) {
+        // start over without it
+        if (ftruncate(fd, 0) != 0)
+            return false;
+        cloned = false;
+    }
+    return fill(fd, content, base, cloned);
+}
+
+static void publish(const std::string& tmp, const std::string& path) {
+    if (rename(tmp.c_str(), path.c_str()) != 0) {
+        int err = errno;
+        unlink(tmp.c_str());
+        errno = err;
+        throw write_error(path);
+    }
+}
+
+void write_file(const PieceTable& content, const std::string& path, const ElfView* base, bool clone) {
+    // unnamed file gets its (temporary) name only when it's complete
+    int fd = open(dir_of(path).c_str(), O_TMPFILE | O_WRONLY | O_CLOEXEC, OUTPUT_MODE);
+    if (fd >= 0) {
+        if (!fill_from(fd, content, base, clone)) {
+            int err = errno;
+            close(fd);
+            errno = err;
+            throw write_error(path);
+        }
+        std::string proc_path = "/proc/self/fd/" + std::to_string(fd);
+        std::string tmp = temp_name(path);
+        bool linked = linkat(AT_FDCWD, proc_path.c_str(), AT_FDCWD, tmp.c_str(), AT_SYMLINK_FOLLOW) == 0;
+        close(fd);
+        if (linked) {
+            publish(tmp, path);
+            return;
+        }
+        // e.g. /proc not mounted - write again under temporary name
+    }
+
+    std::string tmp = temp_name(path);
+    fd = open(tmp.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, OUTPUT_MODE);
+    if (fd < 0)
+        throw write_error(path);
+    bool ok = fill_from(fd, content, base, clone);
+    int err = errno;
+    if (close(fd) != 0 && ok) {
+        ok = false;
+        err = errno;
+    }
+    if (!ok) {
+        unlink(tmp.c_str());
+        errno = err;
+        throw write_error(path);
+    }
+    publish(tmp, path);
+}
+
+bool place_file(const std::string& src, const std::string& path, bool hard_link) {
+    int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        if (errno == ENOENT)
+            return false;
+        throw "ERROR: Cannot read " + src + ": " + strerror(errno);
+    }
+    // renaming another link of the same inode over it does nothing, temporary name would stay
+    struct stat st, cur;
+    if (fstat(in, &st) == 0 && stat(path.c_str(), &cur) == 0 && st.st_dev == cur.st_dev && st.st_ino == cur.st_ino) {
+        close(in);
+        return true;
+    }
+    std::string tmp = temp_name(path);
+    int fd = fstat(in, &st) == 0 ? open(tmp.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, OUTPUT_MODE) : -1;
+    if (fd < 0) {
+        int err = errno;
+        close(in);
+        errno = err;
+        throw write_error(path);
+    }
+
+    bool ok = ioctl(fd, FICLONE, in) == 0;
+    if (ok) {
+        count_cloned(st.st_size);
+    } else {
+        // new name of the same inode (if allowed), otherwise bytes are copied
+        if (hard_link) {
+            close(fd);
+            unlink(tmp.c_str());
+            fd = -1;
+            ok = link(src.c_str(), tmp.c_str()) == 0;
+            if (!ok)
+                fd = open(tmp.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, OUTPUT_MODE);
+        }
+        if (fd >= 0)
+            ok = ftruncate(fd, st.st_size) == 0 && copy_range(fd, in, 0, 0, st.st_size);
+    }
+    int err = errno;
+    if (fd >= 0 && fchmod(fd, OUTPUT_MODE) != 0 && ok) {
+        ok = false;
+        err = errno;
+    }
+    if (fd >= 0 && close(fd) != 0 && ok) {
+        ok = false;
+        err = errno;
+    }
+    close(in);
+    if (!ok) {
+        unlink(tmp.c_str());
+        errno = err;
+        throw write_error(path);
+    }
+    publish(tmp, path);
+    return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+
+#include "ElfView.hpp"
+#include "PieceTable.hpp"
+
+/**
+ * Atomically replaces `path` with executable (0755) file of `content`.
+ * File is created unnamed (O_TMPFILE) or under temporary name in the same
+ * directory, written with pwritev straight from pieces (holes stay sparse)
+ * and renamed over `path` only when complete - readers never see partial file.
+ *
+ * Pieces viewing `base` file are copied from it in kernel (holes skipped),
+ * never through its mapping - memory use doesn't depend on file size.
+ * If `clone` and most of `base` bytes stay at their offsets in `content`,
+ * file starts as clone of `base` (FICLONE, shares extents on btrfs/xfs; falls
+ * back to copy_file_range) and only the delta is written.
+ *
+ * Throws std::string on failure, leaving `path` untouched.
+ **/
+void write_file(const PieceTable& content, const std::string& path,
+                const ElfView* base = nullptr, bool clone = true);
+
+/**
+ * Atomically replaces `path` with file `src`: reflink (FICLONE), then (only with
+ * `hard_link`) hard link, then copy in kernel (holes skipped) - first one that
+ * works. Hard linked `path` shares inode with `src`, so writing either one in place
+ * changes both. Nothing is done if `path` already is `src` (the same inode).
+ * Returns false if `src` doesn't exist, throws std::string on other failures,
+ * leaving `path` untouched.
+ **/
+bool place_file(const std::string& src, const std::string& path, bool hard_link = false);
@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <map>
+#include <unistd.h>
+
+#include "Layout.hpp"
+
+static const size_t HUGE_PAGE = 0x200000;
+
+Elf64_Word get_phflags(Elf64_Xword sh_flags) {
+    Elf64_Word flags = 0;
+
+    flags |= PF_R;
+
+    if (sh_flags & SHF_WRITE) {
+        flags |= PF_W;
+    }
+
+    if (sh_flags & SHF_EXECINSTR) {
+        flags |= PF_X;
+    }
+
+    return flags;
+}
+
+// sh_addralign 0 and 1 both mean no constraint
+static size_t align_up(size_t v, size_t align) {
+    return align <= 1 ? v : (v + align - 1) / align * align;
+}
+
+layout_plan plan_layout(const std::vector<section_descr>& sections_to_move, bool huge_rx, size_t headroom) {
+    const size_t page = getpagesize();
+    layout_plan plan{std::vector<size_t>(sections_to_move.size(), 0), {}, page, 0};
+
+    // ordered by flags value: R, RX, RW (RWX, if any, last)
+    std::map<Elf64_Word, std::vector<size_t>> groups;
+    for (size_t i = 0; i < sections_to_move.size(); i++) {
+        const Elf64_Shdr& hdr = sections_to_move[i].first;
+        groups[get_phflags(hdr.sh_flags)].push_back(i);
+        plan.align = std::max<size_t>(plan.align, hdr.sh_addralign);
+    }
+
+    // huge RX segment goes first - layout start is aligned to 2MB anyway
+    std::vector<std::pair<const Elf64_Word, std::vector<size_t>>*> order;
+    for (auto& group : groups) {
+        bool huge = huge_rx && group.first == (PF_R | PF_X);
+        order.insert(huge ? order.begin() : order.end(), &group);
+    }
+
+    size_t off = 0;
+    for (auto* group_ptr : order) {
+        auto& group = *group_ptr;
+        std::vector<size_t>& idxs = group.second;
+        // NOBITS sections only extend memory size, so they go last
+        std::stable_partition(idxs.begin(), idxs.end(), [&](size_t i) {
+            return sections_to_move[i].first.sh_type != SHT_NOBITS;
+        });
+
+        bool huge = huge_rx && group.first == (PF_R | PF_X);
+        size_t seg_align = huge ? HUGE_PAGE : page;
+        plan.align = std::max(plan.align, seg_align);
+
+        segment_plan seg{group.first, align_up(off, seg_align), 0, 0, seg_align, idxs};
+        off = seg.offset;
+        for (size_t i : idxs) {
+            const Elf64_Shdr& hdr = sections_to_move[i].first;
+            off = align_up(off, hdr.sh_addralign);
+            plan.offsets[i] = off;
+            off += hdr.sh_size;
+            if (hdr.sh_type != SHT_NOBITS)
+                seg.filesz = off - seg.offset;
+        }
+        seg.memsz = off - seg.offset;
+        if (huge && seg.memsz > 0) {
+            off = align_up(off, HUGE_PAGE);
+            seg.filesz = seg.memsz = off - seg.offset;
+        }
+
+        // nothing to map
+        if (seg.memsz > 0) {
+            if (headroom > 0)
+                off = align_up(off + headroom, seg_align);
+            plan.segments.push_back(std::move(seg));
+        }
+    }
+    plan.size = off;
+    return plan;
+}
+
+std::vector<segment_slot> layout_slots(const layout_plan& plan) {
+    std::vector<segment_slot> res;
+    for (size_t i = 0; i < plan.segments.size(); i++) {
+        const segment_plan& seg = plan.segments[i];
+        size_t end = i + 1 < plan.segments.size() ? plan.segments[i + 1].offset : plan.size;
+        res.push_back(segment_slot{seg.flags, seg.offset, end - seg.offset});
+    }
+    return res;
+}
+
+bool pin_layout(layout_plan& plan, const std::vector<segment_slot>& slots) {
+    std::vector<size_t> target(plan.segments.size());
+    for (size_t i = 0; i < plan.segments.size(); i++) {
+        const segment_plan& seg = plan.segments[i];
+        auto slot = std::find_if(slots.begin(), slots.end(), [&](const segment_slot& s) {
+            return s.flags == seg.flags;
+        });
+        // sections inside keep their alignment only if whole segment moves by multiple of it
+        if (slot == slots.end() || seg.memsz > slot->size || slot->offset % plan.align != 0)
+            return false;
+        target[i] = slot->offset;
+    }
+
+    size_t size = 0;
+    for (const segment_slot& slot : slots)
+        size = std::max(size, slot.offset + slot.size);
+    size = align_up(size, plan.align);
+
+    // empty sections of dropped (empty) segments go to the end
+    std::vector<size_t> offsets(plan.offsets.size(), size);
+    for (size_t i = 0; i < plan.segments.size(); i++) {
+        segment_plan& seg = plan.segments[i];
+        for (size_t idx : seg.sections)
+            offsets[idx] = plan.offsets[idx] - seg.offset + target[i];
+        seg.offset = target[i];
+    }
+    plan.offsets = std::move(offsets);
+    std::sort(plan.segments.begin(), plan.segments.end(), [](const segment_plan& a, const segment_plan& b) {
+        return a.offset < b.offset;
+    });
+    plan.size = size;
+    return true;
+}
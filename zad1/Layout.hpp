@@ -0,0 +1,71 @@
+#pragma once
+
+#include <elf.h>
+#include <vector>
+
+#include "ElfImage.hpp"
+
+Elf64_Word get_phflags(Elf64_Xword sh_flags);
+
+/**
+ * One PT_LOAD of moved sections - all of them have same permissions.
+ * Offsets are relative to beginning of whole layout.
+ **/
+struct segment_plan {
+    Elf64_Word flags;
+    size_t offset;
+    size_t filesz;
+    size_t memsz;
+    size_t align;
+    std::vector<size_t> sections; // indices to `sections_to_move`, in placement order
+};
+
+/**
+ * Placement of sections moved from ET_RELs into ET_EXEC.
+ * Sections are grouped by permissions (R, RX, RW with NOBITS at the end),
+ * each group becomes one segment starting at new page, and sections inside
+ * it are packed to their sh_addralign. Layout must start at address
+ * (both in file and in memory) aligned to `align`.
+ *
+ * With `huge_rx` RX segment starts at 2MB boundary and is padded (with hole)
+ * to whole 2MB pages, so that it can be backed by huge pages
+ * (file THP or MADV_HUGEPAGE / MADV_COLLAPSE). That increases file size.
+ **/
+struct layout_plan {
+    std::vector<size_t> offsets; // per section (same order as `sections_to_move`)
+    std::vector<segment_plan> segments;
+    size_t align;
+    size_t size; // in file
+};
+
+/**
+ * Space reserved for segment of given flags: `size` bytes from `offset`
+ * (relative to layout start) - its memsz and headroom behind it.
+ **/
+struct segment_slot {
+    Elf64_Word flags;
+    size_t offset;
+    size_t size;
+};
+
+/**
+ * With `headroom` > 0, that many bytes (rounded up to segment alignment) are left
+ * free behind every segment, so it can grow in place when layout is re-planned
+ * (see `pin_layout`). They are neither mapped nor stored - only address space
+ * and apparent file size grow.
+ **/
+layout_plan plan_layout(const std::vector<section_descr>& sections_to_move, bool huge_rx = false,
+                        size_t headroom = 0);
+
+/**
+ * Slot of every segment of `plan`, up to the next one (or end of layout).
+ **/
+std::vector<segment_slot> layout_slots(const layout_plan& plan);
+
+/**
+ * Moves every segment of `plan` to the slot of the same flags, keeping its address
+ * relative to layout start. `plan.size` then covers all `slots`.
+ * Returns false (and leaves `plan` untouched) if some segment has no slot, doesn't
+ * fit into it, or would break alignment.
+ **/
+bool pin_layout(layout_plan& plan, const std::vector<segment_slot>& slots);
@@ -0,0 +1,1632 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <elf.h>
+#include <iostream>
+#include <map>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Utils.hpp"
+#include "SectionEditor.hpp"
+#include "FileWriter.hpp"
+#include "Linker.hpp"
+#include "WorkerPool.hpp"
+
+typedef SectionEditor SE;
+
+const static u_int64_t EXEC_BASE = 0x400000;
+
+std::string hash_string(uint64_t h, size_t length) {
+    const char charset[] =
+        "0123456789"
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+        "abcdefghijklmnopqrstuvwxyz";
+    const size_t max_index = (sizeof(charset) - 1);
+    std::string str(length, 0);
+    for (char& c : str) {
+        c = charset[h % max_index];
+        h /= max_index;
+    }
+    return str;
+}
+
+/**
+ * Maps input file, nothing is copied here.
+ **/
+static ElfView open_input(const std::string& fname, int advice) {
+    try {
+        return ElfView{fname, advice};
+    } catch (const char * f) {
+        throw "ERROR: Cannot open " + std::string(f) + "!";
+    }
+}
+
+static void check_input(const ElfView& view, const std::string& fname) {
+    try {
+        integrity_check(get_elf_header(view.view()));
+    } catch (const char * s) {
+        throw fname + " error: " + s;
+    }
+}
+
+// ET_EXEC is never copied as a whole - output image views mapped bytes,
+// only metadata is read through mapping (bulk is copied from file to file)
+ExecInput::ExecInput(const std::string& fname)
+    : view(open_input(fname, MADV_RANDOM)),
+      img((check_input(view, fname), view.view())) {
+}
+
+const SymbolIndex& ExecInput::syms() const {
+    std::call_once(syms_once, [this]() {
+        syms_index = std::make_unique<SymbolIndex>(img);
+    });
+    return *syms_index;
+}
+
+const CacheHasher& ExecInput::content_hash() const {
+    std::call_once(hash_once, [this]() {
+        hash_file(view, hash);
+    });
+    return hash;
+}
+
+uint64_t inputs_digest(const ElfImage& exec, const std::vector<ElfView>& rel_views) {
+    PlanHasher h;
+    h.add(&exec.header(), sizeof(Elf64_Ehdr));
+    for (const Elf64_Phdr& ph : exec.phs())
+        h.add(&ph, sizeof(ph));
+    for (const auto& sec : exec.shdrs()) {
+        h.add(&sec.first, sizeof(Elf64_Shdr));
+        h.add(sec.second);
+    }
+    h.add((uint64_t) exec.size());
+    for (const ElfView& view : rel_views)
+        h.add(view.view());
+    return h.value();
+}
+
+CacheKey output_key(const ExecInput& exec, const std::vector<ElfView>& rel_views, const LinkOptions& options) {
+    CacheHasher h = exec.content_hash();
+    h.add(CACHE_VERSION);
+    h.add((uint64_t) rel_views.size());
+    for (const ElfView& view : rel_views)
+        h.add(view.view());
+    h.add((uint64_t) options.huge_rx);
+    h.add((uint64_t) options.prepend_phdrs);
+    h.add((uint64_t) options.reuse_notes);
+    h.add((uint64_t) options.repatch);
+    h.add((uint64_t) options.headroom);
+    h.add((uint64_t) options.gc_sections);
+    for (const std::string& name : options.keep)
+        h.add(name);
+    h.add((uint64_t) options.merge);
+    h.add((uint64_t) options.merge_exec_rodata);
+    h.add((uint64_t) options.icf);
+    for (const detour_spec& d : options.detours) {
+        h.add(d.exec_sym);
+        h.add(d.rel_sym);
+        h.add((uint64_t) d.wrap);
+    }
+    h.add((uint64_t) options.rewrite_calls);
+    return h.value();
+}
+
+static size_t parse_count(const std::string& str, const std::string& arg) {
+    if (str.empty() || str.find_first_not_of("0123456789") != std::string::npos || str.size() > 6)
+        throw "invalid option " + arg;
+    return std::stoul(str);
+}
+
+// bytes, with optional K/M/G suffix
+static size_t parse_size(const std::string& str, const std::string& arg) {
+    size_t shift = 0;
+    std::string digits = str;
+    if (!digits.empty() && std::string("KMG").find(digits.back()) != std::string::npos) {
+        shift = digits.back() == 'K' ? 10 : digits.back() == 'M' ? 20 : 30;
+        digits.pop_back();
+    }
+    if (digits.empty() || digits.find_first_not_of("0123456789") != std::string::npos || digits.size() > 9)
+        throw "invalid option " + arg;
+    return std::stoul(digits) << shift;
+}
+
+LinkJob parse_job(const std::vector<std::string>& args) {
+    LinkJob job;
+    size_t i = 0;
+    for (; i < args.size() && args[i].compare(0, 2, "--") == 0; i++) {
+        if (args[i] == "--huge-rx")
+            job.options.huge_rx = true;
+        else if (args[i] == "--prepend-phdrs")
+            job.options.prepend_phdrs = true;
+        else if (args[i] == "--reuse-notes")
+            job.options.reuse_notes = true;
+        else if (args[i] == "--no-clone")
+            job.options.clone_output = false;
+        else if (args[i] == "--stats")
+            job.options.stats = StatsFormat::text;
+        else if (args[i] == "--stats=json")
+            job.options.stats = StatsFormat::json;
+        else if (args[i].compare(0, 12, "--save-plan=") == 0 && args[i].size() > 12)
+            job.options.save_plan = args[i].substr(12);
+        else if (args[i].compare(0, 13, "--apply-plan=") == 0 && args[i].size() > 13)
+            job.options.apply_plan = args[i].substr(13);
+        else if (args[i].compare(0, 16, "--reloc-threads=") == 0)
+            job.options.reloc_threads = parse_count(args[i].substr(16), args[i]);
+        else if (args[i].compare(0, 12, "--cache-dir=") == 0 && args[i].size() > 12)
+            job.options.cache_dir = args[i].substr(12);
+        else if (args[i] == "--cache-hardlink")
+            job.options.cache_hardlink = true;
+        else if (args[i] == "--gc-sections")
+            job.options.gc_sections = true;
+        else if (args[i].compare(0, 7, "--keep=") == 0 && args[i].size() > 7)
+            job.options.keep.push_back(args[i].substr(7));
+        else if (args[i] == "--no-merge")
+            job.options.merge = false;
+        else if (args[i] == "--merge-exec-rodata")
+            job.options.merge_exec_rodata = true;
+        else if (args[i].compare(0, 9, "--detour=") == 0 || args[i].compare(0, 7, "--wrap=") == 0) {
+            detour_spec d;
+            d.wrap = args[i][2] == 'w';
+            std::string pair = args[i].substr(d.wrap ? 7 : 9);
+            size_t eq = pair.find('=');
+            if (eq == 0 || eq == std::string::npos || eq + 1 == pair.size())
+                throw "invalid option " + args[i];
+            d.exec_sym = pair.substr(0, eq);
+            d.rel_sym = pair.substr(eq + 1);
+            job.options.detours.push_back(d);
+        }
+        else if (args[i] == "--rewrite-calls")
+            job.options.rewrite_calls = true;
+        else if (args[i] == "--icf")
+            job.options.icf = true;
+        else if (args[i] == "--repatch")
+            job.options.repatch = true;
+        else if (args[i].compare(0, 11, "--headroom=") == 0)
+            job.options.headroom = parse_size(args[i].substr(11), args[i]);
+        else
+            throw "unknown option " + args[i];
+    }
+    // prepended page shifts every byte, nothing could be reused
+    if (job.options.repatch && job.options.prepend_phdrs)
+        throw std::string("--repatch can't be combined with --prepend-phdrs");
+    // cache hit resolves nothing, there would be no plan to save
+    if (!job.options.save_plan.empty() && !job.options.cache_dir.empty())
+        throw std::string("--save-plan can't be combined with --cache-dir");
+    if (job.options.rewrite_calls && job.options.detours.empty())
+        throw std::string("--rewrite-calls needs --detour or --wrap");
+    // patch record doesn't keep bytes detour jumps overwrite
+    if (job.options.repatch && !job.options.detours.empty())
+        throw std::string("--repatch can't be combined with --detour or --wrap");
+    if (args.size() - i < 3)
+        throw std::string("expected [options] <ET_EXEC file> <ET_REL file>... <target ET_EXEC file>");
+
+    job.exec_fname = args[i];
+    job.rel_fnames.assign(args.begin() + i + 1, args.end() - 1);
+    job.out_fname = args.back();
+    return job;
+}
+
+size_t compute_head_size(const ElfImage& exec, const layout_plan& plan) {
+    const Elf64_Ehdr& hdr = exec.header();
+    // '1' for additional PT_LOAD with new headers
+    size_t bytes = hdr.e_ehsize + (hdr.e_phnum + 1 + plan.segments.size()) * hdr.e_phentsize;
+    size_t page = getpagesize();
+    return (bytes + page - 1) / page * page;
+}
+
+symbol_descr find_corresponding_symbol(const SymbolIndex& exec_syms, symbol_descr rel_sym) {
+    if (rel_sym.second == "orig_start") {
+        rel_sym.second = "_start";
+    }
+    size_t idx = exec_syms.find(rel_sym.second);
+    if (idx != SymbolIndex::npos) {
+        return exec_syms.descr(idx);
+    }
+    throw "Linking error: Malformed binary: No " + rel_sym.second + " symbol in ET_EXEC file!";
+}
+
+rel_globals collect_rel_globals(const std::vector<rel_input>& rels) {
+    rel_globals res;
+    for (size_t k = 0; k < rels.size(); k++) {
+        const SymbolIndex& syms = *rels[k].syms;
+        for (size_t i = 0; i < syms.size(); i++) {
+            const Elf64_Sym& sym = syms.at(i);
+            int bind = ELF64_ST_BIND(sym.st_info);
+            if (sym.st_shndx == SHN_UNDEF || bind == STB_LOCAL || syms.name(i).empty())
+                continue;
+
+            auto pair = res.emplace(std::string(syms.name(i)), std::make_pair(k, i));
+            if (pair.second)
+                continue;
+            auto prev = pair.first->second;
+            int prev_bind = ELF64_ST_BIND(rels[prev.first].syms->at(prev.second).st_info);
+            if (bind == STB_GLOBAL && prev_bind == STB_GLOBAL)
+                throw "Linking error: multiple definition of " + pair.first->first;
+            if (bind == STB_GLOBAL)
+                pair.first->second = std::make_pair(k, i); // strong one overrides weak
+        }
+    }
+    return res;
+}
+
+symbol_descr moved_symbol(const ElfImage& exec, const rel_input& in, size_t sym_idx) {
+    symbol_descr res = in.syms->descr(sym_idx);
+    Elf64_Section shndx = res.first.st_shndx;
+    if (shndx == SHN_ABS)
+        return res;
+    if (shndx >= in.moved.size() || in.moved[shndx] == 0)
+        throw "Linking error: symbol " + res.second + " is not defined in loadable section (COMMON symbols require -fno-common)";
+
+    // in ET_REL st_value field keeps offset from `st_shndx` begin
+    size_t base = exec.shdrs()[in.moved[shndx]].first.sh_addr;
+    auto merged = in.merged.find(shndx);
+    if (merged != in.merged.end())
+        res.first.st_value = merged->second.vaddr(res.first.st_value, base);
+    else
+        res.first.st_value += base;
+    return res;
+}
+
+/**
+ * Calls `fn(target section index, relocation entries)` for every relocation
+ * section of sections moved from `in`.
+ **/
+template<typename F>
+static void for_each_rela_section(const rel_input& in, F fn) {
+    for (auto& rela : in.img.shdrs()) {
+        if (rela.first.sh_type != SHT_RELA)
+            continue;
+        assert(rela.second.substr(0, 5) == ".rela");
+
+        size_t target = rela.first.sh_info;
+        if (in.img.shdrs()[target].second == ".eh_frame" || in.moved[target] == 0 || in.folded.count(target)) {
+            continue;
+        }
+
+        assert(rela.first.sh_size % sizeof(Elf64_Rela) == 0);
+        fn(target, in.img.section_content(rela.first));
+    }
+}
+
+/**
+ * Calls `fn(target section index, rela)` for every entry of `relas`.
+ **/
+template<typename F>
+static void for_each_rela(size_t target, std::string_view relas, F fn) {
+    for (size_t i = 0; i < relas.size(); i+=sizeof(Elf64_Rela)) {
+        Elf64_Rela r;
+        memcpy(&r, &relas.data()[i], sizeof(Elf64_Rela));
+        fn(target, r);
+    }
+}
+
+/**
+ * Calls `fn(target section index, rela)` for every relocation of sections moved from `in`.
+ **/
+template<typename F>
+static void for_each_rela(const rel_input& in, F fn) {
+    for_each_rela_section(in, [&](size_t target, std::string_view relas) {
+        for_each_rela(target, relas, fn);
+    });
+}
+
+static std::string got_key(const rel_input& in, size_t sym_idx) {
+    if (in.syms->at(sym_idx).st_shndx == SHN_UNDEF)
+        return std::string(in.syms->name(sym_idx));
+    return in.prefix + ":" + std::to_string(sym_idx);
+}
+
+// bytes of moved section up to relocated field are the same in ET_REL and in output
+static bool relaxable(const rel_input& in, size_t target, const Elf64_Rela& r) {
+    unsigned type = ELF64_R_TYPE(r.r_info);
+    std::string_view code = in.img.section_content(in.img.shdrs()[target].first);
+    return gotpcrel_relaxable(type, code.substr(0, std::min<size_t>(r.r_offset, code.size())));
+}
+
+// relaxed relocation reaches symbol directly, ET_EXEC's (or absolute) one may be
+// out of range of injected code - then its slot is used after all
+static bool needs_got(const rel_input& in, const rel_globals& globals, size_t target, const Elf64_Rela& r) {
+    if (!is_gotpcrel(ELF64_R_TYPE(r.r_info)))
+        return false;
+    if (!relaxable(in, target, r))
+        return true;
+    size_t sym_idx = ELF64_R_SYM(r.r_info);
+    const Elf64_Sym& sym = in.syms->at(sym_idx);
+    if (sym.st_shndx == SHN_UNDEF)
+        return globals.count(std::string(in.syms->name(sym_idx))) == 0;
+    return sym.st_shndx == SHN_ABS;
+}
+
+std::vector<std::vector<bool>> live_sections(const std::vector<rel_input>& rels, const rel_globals& globals,
+                                             const std::vector<std::string>& keep) {
+    std::vector<std::vector<bool>> live(rels.size());
+    std::vector<std::pair<size_t, size_t>> todo; // input, section
+    auto mark = [&](size_t k, size_t shndx) {
+        // SHN_ABS, SHN_COMMON... are not sections
+        if (shndx == SHN_UNDEF || shndx >= live[k].size() || live[k][shndx])
+            return;
+        live[k][shndx] = true;
+        todo.emplace_back(k, shndx);
+    };
+    // undefined symbols lead to ET_REL defining them, ET_EXEC's ones nowhere
+    auto mark_symbol = [&](size_t k, size_t sym_idx) {
+        const Elf64_Sym& sym = rels[k].syms->at(sym_idx);
+        if (sym.st_shndx != SHN_UNDEF) {
+            mark(k, sym.st_shndx);
+            return;
+        }
+        auto it = globals.find(std::string(rels[k].syms->name(sym_idx)));
+        if (it != globals.end())
+            mark(it->second.first, rels[it->second.first].syms->at(it->second.second).st_shndx);
+    };
+
+    // relocation sections of every section
+    std::vector<std::vector<std::vector<size_t>>> relas(rels.size());
+    for (size_t k = 0; k < rels.size(); k++) {
+        const auto& shdrs = rels[k].img.shdrs();
+        live[k].assign(shdrs.size(), false);
+        relas[k].resize(shdrs.size());
+        for (size_t i = 0; i < shdrs.size(); i++) {
+            const Elf64_Shdr& hdr = shdrs[i].first;
+            if (hdr.sh_type == SHT_RELA && hdr.sh_info < shdrs.size())
+                relas[k][hdr.sh_info].push_back(i);
+        }
+        for (size_t i = 0; i < shdrs.size(); i++) {
+            if (shdrs[i].first.sh_flags & SHF_GNU_RETAIN)
+                mark(k, i);
+        }
+    }
+
+    std::vector<std::string> roots = keep;
+    roots.push_back("_start");
+    for (const std::string& name : roots) {
+        auto it = globals.find(name);
+        if (it == globals.end() && name != "_start")
+            throw "Linking error: kept symbol " + name + " is not defined in ET_REL files";
+        if (it != globals.end())
+            mark(it->second.first, rels[it->second.first].syms->at(it->second.second).st_shndx);
+    }
+    if (todo.empty()) {
+        std::cerr << "[INFO] no _start nor kept symbol in ET_REL, --gc-sections keeps everything\n";
+        return {};
+    }
+
+    while (!todo.empty()) {
+        size_t k = todo.back().first, sec = todo.back().second;
+        todo.pop_back();
+        for (size_t r : relas[k][sec]) {
+            for_each_rela(sec, rels[k].img.section_content(rels[k].img.shdrs()[r].first),
+                          [&](size_t, const Elf64_Rela& rela) {
+                mark_symbol(k, ELF64_R_SYM(rela.r_info));
+            });
+        }
+    }
+    return live;
+}
+
+bool merge_candidate(const rel_input& in, size_t shndx) {
+    const Elf64_Shdr& hdr = in.img.shdrs()[shndx].first;
+    if ((hdr.sh_flags & (SHF_ALLOC | SHF_MERGE)) != (SHF_ALLOC | SHF_MERGE) || hdr.sh_type == SHT_NOBITS
+        || !mergeable(hdr, in.img.section_content(hdr)))
+        return false;
+    // entries with relocations would have to be compared after relocating
+    for (auto& sec : in.img.shdrs()) {
+        if (sec.first.sh_type == SHT_RELA && sec.first.sh_info == shndx)
+            return false;
+    }
+    return true;
+}
+
+std::map<rel_section, rel_section> fold_identical(const std::vector<rel_input>& rels, const rel_globals& globals,
+                                                  const std::vector<rel_section>& candidates, bool merge) {
+    std::map<rel_section, size_t> index; // candidate -> its position
+    for (size_t c = 0; c < candidates.size(); c++)
+        index.emplace(candidates[c], c);
+    std::vector<std::vector<bool>> merged(rels.size());
+    for (size_t k = 0; k < rels.size() && merge; k++) {
+        for (size_t i = 0; i < rels[k].img.shdrs().size(); i++)
+            merged[k].push_back(merge_candidate(rels[k], i));
+    }
+
+    // everything but classes of targets among candidates, these are (candidate, offset in it)
+    std::vector<std::string> keys(candidates.size());
+    std::vector<std::vector<std::pair<size_t, uint64_t>>> refs(candidates.size());
+    auto put = [](std::string& key, uint64_t val) { key.append((const char*) &val, sizeof(val)); };
+    for (size_t c = 0; c < candidates.size(); c++) {
+        size_t k = candidates[c].first, sec = candidates[c].second;
+        const rel_input& in = rels[k];
+        const Elf64_Shdr& hdr = in.img.shdrs()[sec].first;
+        std::string& key = keys[c];
+        put(key, hdr.sh_flags);
+        put(key, hdr.sh_addralign);
+        put(key, hdr.sh_size);
+        key += in.img.section_content(hdr);
+
+        std::vector<Elf64_Rela> relas;
+        for (auto& rela : in.img.shdrs()) {
+            if (rela.first.sh_type == SHT_RELA && rela.first.sh_info == sec)
+                for_each_rela(sec, in.img.section_content(rela.first), [&](size_t, const Elf64_Rela& r) {
+                    relas.push_back(r);
+                });
+        }
+        std::stable_sort(relas.begin(), relas.end(), [](const Elf64_Rela& a, const Elf64_Rela& b) {
+            return a.r_offset < b.r_offset;
+        });
+
+        for (const Elf64_Rela& r : relas) {
+            put(key, r.r_offset);
+            put(key, ELF64_R_TYPE(r.r_info));
+            size_t kk = k, idx = ELF64_R_SYM(r.r_info);
+            const Elf64_Sym* sym = &in.syms->at(idx);
+            if (sym->st_shndx == SHN_UNDEF) {
+                auto it = globals.find(std::string(in.syms->name(idx)));
+                if (it == globals.end()) {
+                    // from ET_EXEC
+                    key += 'E';
+                    key += in.syms->name(idx);
+                    key += '\0';
+                    put(key, r.r_addend);
+                    continue;
+                }
+                kk = it->second.first;
+                idx = it->second.second;
+                sym = &rels[kk].syms->at(idx);
+            }
+
+            size_t shndx = sym->st_shndx;
+            auto cand = index.find(std::make_pair(kk, shndx));
+            if (cand != index.end()) {
+                key += 'C';
+                refs[c].emplace_back(cand->second, sym->st_value);
+                put(key, r.r_addend);
+                continue;
+            }
+            if (shndx < merged[kk].size() && merged[kk][shndx]) {
+                // merged entries are the same when their bytes are, section symbol + addend points to one
+                const Elf64_Shdr& target = rels[kk].img.shdrs()[shndx].first;
+                bool section_sym = ELF64_ST_TYPE(sym->st_info) == STT_SECTION;
+                size_t loc = sym->st_value + (section_sym ? r.r_addend : 0);
+                auto entry = merge_entry_at(target, rels[kk].img.section_content(target), loc);
+                if (!entry.first.empty()) {
+                    key += 'M';
+                    put(key, target.sh_flags);
+                    put(key, target.sh_entsize);
+                    put(key, target.sh_addralign);
+                    put(key, entry.first.size());
+                    key += entry.first;
+                    put(key, loc - entry.second);
+                    put(key, section_sym ? 0 : r.r_addend);
+                    continue;
+                }
+            }
+            key += 'S';
+            put(key, shndx == SHN_ABS ? 0 : kk);
+            put(key, shndx);
+            put(key, sym->st_value);
+            put(key, r.r_addend);
+        }
+    }
+
+    std::vector<size_t> cls(candidates.size());
+    std::map<std::string, size_t> first_classes;
+    for (size_t c = 0; c < candidates.size(); c++)
+        cls[c] = first_classes.emplace(keys[c], first_classes.size()).first->second;
+    // targets among candidates are compared by class, until classes stop splitting
+    size_t count = first_classes.size();
+    while (true) {
+        std::map<std::vector<uint64_t>, size_t> classes;
+        std::vector<size_t> next(candidates.size());
+        for (size_t c = 0; c < candidates.size(); c++) {
+            std::vector<uint64_t> key{cls[c]};
+            for (auto& ref : refs[c]) {
+                key.push_back(cls[ref.first]);
+                key.push_back(ref.second);
+            }
+            next[c] = classes.emplace(std::move(key), classes.size()).first->second;
+        }
+        cls = std::move(next);
+        if (classes.size() == count)
+            break;
+        count = classes.size();
+    }
+
+    std::map<rel_section, rel_section> res;
+    std::vector<size_t> kept(count, std::string::npos);
+    for (size_t c = 0; c < candidates.size(); c++) {
+        if (kept[cls[c]] == std::string::npos)
+            kept[cls[c]] = c;
+        else
+            res.emplace(candidates[c], candidates[kept[cls[c]]]);
+    }
+    return res;
+}
+
+got_table collect_got_slots(const std::vector<rel_input>& rels, const rel_globals& globals) {
+    got_table res;
+    for (const rel_input& in : rels) {
+        for_each_rela(in, [&](size_t target, const Elf64_Rela& r) {
+            if (needs_got(in, globals, target, r))
+                res.slots.emplace(got_key(in, ELF64_R_SYM(r.r_info)), res.slots.size());
+        });
+    }
+    return res;
+}
+
+static rela_descr resolve_rela(const ElfImage& exec, const std::vector<rel_input>& rels, size_t k,
+                               size_t target, const Elf64_Rela& r,
+                               const SymbolIndex& exec_syms, const rel_globals& globals, const got_table& got) {
+    const rel_input& in = rels[k];
+    size_t target_vaddr = exec.shdrs()[in.moved[target]].first.sh_addr;
+
+    size_t sym_idx = ELF64_R_SYM(r.r_info);
+    const Elf64_Sym& rel_sym = in.syms->at(sym_idx);
+
+    // now, we have symbol that maybe is in ET_EXEC, 
+    // but first check whether it occurs in any ET_REL.
+    symbol_descr result_sym;
+
+    if (rel_sym.st_shndx != SHN_UNDEF) {
+        result_sym = moved_symbol(exec, in, sym_idx);
+        // section symbol + addend is what points into merged section (as in ld),
+        // so the entry is found by the sum and addend is kept
+        auto merged = in.merged.find(rel_sym.st_shndx);
+        if (ELF64_ST_TYPE(rel_sym.st_info) == STT_SECTION && merged != in.merged.end()) {
+            size_t base = exec.shdrs()[in.moved[rel_sym.st_shndx]].first.sh_addr;
+            result_sym.first.st_value = merged->second.vaddr(rel_sym.st_value + r.r_addend, base) - r.r_addend;
+        }
+    } else {
+        count_symbol_lookup();
+        auto it = globals.find(std::string(in.syms->name(sym_idx)));
+        if (it != globals.end()) {
+            result_sym = moved_symbol(exec, rels[it->second.first], it->second.second);
+        } else {
+            // we have obtained UND symbol from ET_REL,
+            // now we must obtain corresponding one from
+            // ET_EXEC, thus find it by name
+            result_sym = find_corresponding_symbol(exec_syms, in.syms->descr(sym_idx));
+        }
+    }
+
+    size_t vaddr = target_vaddr + r.r_offset;
+    size_t got_vaddr = 0;
+    if (needs_got(in, globals, target, r)) {
+        // relaxed only if direct displacement fits, with a byte to spare for
+        // `jmp`, whose displacement moves back
+        int64_t disp = (int64_t) result_sym.first.st_value + r.r_addend - (int64_t) vaddr;
+        if (!relaxable(in, target, r) || disp <= INT32_MIN || disp >= INT32_MAX)
+            got_vaddr = got.slot_vaddr(got_key(in, sym_idx));
+    }
+    return rela_descr {
+        .hdr = r,
+        .symbol = result_sym,
+        .vaddr = vaddr,
+        .got_vaddr = got_vaddr,
+    };
+}
+
+std::vector<rela_descr> get_rela_entries(const ElfImage& exec, const std::vector<rel_input>& rels, size_t k,
+                                         const SymbolIndex& exec_syms, const rel_globals& globals,
+                                         const got_table& got) {
+    std::vector<rela_descr> res;
+    for_each_rela(rels[k], [&](size_t target, const Elf64_Rela& r) {
+        res.push_back(resolve_rela(exec, rels, k, target, r, exec_syms, globals, got));
+    });
+    return res;
+}
+
+static size_t align_up(size_t v, size_t align) {
+    return (v + align - 1) / align * align;
+}
+
+size_t compute_base_vaddr(const ElfImage& exec, size_t size, size_t align) {
+    align = std::max<size_t>(align, 0x200000);
+    const Elf64_Phdr* tbl_load = nullptr;
+    size_t end = 0;
+    for (auto& p : exec.phs()) {
+        if (p.p_type != PT_LOAD)
+            continue;
+        // program header table's own segment is mapped at its file offset, maybe far above
+        if (tbl_load == nullptr && p.p_offset == exec.header().e_phoff) {
+            tbl_load = &p;
+            continue;
+        }
+        // whole segment, it may span many 2MB pages
+        end = std::max(end, p.p_vaddr + p.p_memsz);
+    }
+
+    size_t base = align_up(end, align);
+    if (tbl_load != nullptr && base < tbl_load->p_vaddr + tbl_load->p_memsz
+        && tbl_load->p_vaddr < base + size + 0x200000)
+        base = align_up(std::max(end, tbl_load->p_vaddr + tbl_load->p_memsz), align);
+    return base;
+}
+
+std::vector<Elf64_Phdr> segment_phdrs(const std::vector<section_descr>& sections_to_move,
+                                      const layout_plan& plan, size_t base_vaddr, size_t shift) {
+    std::vector<Elf64_Phdr> res;
+    for (const segment_plan& seg : plan.segments) {
+        // placed sections know where whole layout begins
+        size_t first = seg.sections.front();
+        size_t layout_off = sections_to_move[first].first.sh_offset - plan.offsets[first];
+        size_t off = shift + layout_off + seg.offset;
+        Elf64_Phdr phdr {
+            .p_type = PT_LOAD,
+            .p_flags = seg.flags,
+            .p_offset = off,
+            .p_vaddr = base_vaddr + seg.offset,
+            .p_paddr = base_vaddr + seg.offset,
+            .p_filesz = seg.filesz,
+            .p_memsz = seg.memsz,
+            .p_align = seg.align,
+        };
+        res.push_back(phdr);
+    }
+    return res;
+}
+
+void rewrite_phdrs(ElfImage& exec, const std::vector<section_descr>& sections_to_move,
+                   const layout_plan& plan, size_t base_vaddr) {
+    Elf64_Ehdr exec_hdr = exec.header();
+
+    size_t num_new_phdrs = 1 + plan.segments.size(); // '1' for additional PT_LOAD with new headers
+    size_t whole_size = compute_head_size(exec, plan);
+    std::string begin_buf;
+
+    exec_hdr.e_shoff += whole_size;
+    exec_hdr.e_phoff = exec_hdr.e_ehsize; // just behind elf header
+    exec_hdr.e_phnum += num_new_phdrs;
+
+    begin_buf.append((const char*) &exec_hdr, sizeof(Elf64_Ehdr));
+    auto phdrs = exec.phs();
+
+    // first PT_LOAD segment maps elf header and program headers.
+    // create it manually.
+    Elf64_Phdr first_load {
+        .p_type = PT_LOAD,
+        .p_flags = PF_R | PF_X,
+        .p_offset = 0,
+        .p_vaddr = EXEC_BASE - whole_size,
+        .p_paddr = EXEC_BASE - whole_size,
+        .p_filesz = exec_hdr.e_ehsize + (num_new_phdrs + phdrs.size()) * exec_hdr.e_phentsize,
+        .p_memsz = exec_hdr.e_ehsize + (num_new_phdrs + phdrs.size()) * exec_hdr.e_phentsize,
+        .p_align = (Elf64_Xword) 1,
+    };
+
+    int phdr_pos = -1, _i = 0;
+    for (auto& ph : phdrs) {
+        if (ph.p_type == PT_PHDR) {
+            phdr_pos = _i;
+            size_t addr = EXEC_BASE - whole_size + exec_hdr.e_phoff;
+            ph.p_paddr = addr;
+            ph.p_vaddr = addr;
+        } else {
+            ph.p_offset += whole_size;
+        }
+        _i++;
+    }
+
+    // generate new program headers and add offsets to existing program headers table
+    std::vector<Elf64_Phdr> new_phdrs = segment_phdrs(sections_to_move, plan, base_vaddr, whole_size);
+
+    phdrs.insert(phdrs.end(), new_phdrs.begin(), new_phdrs.end());
+
+    // PT_PHDR (if any) and entries before it, then new table's PT_LOAD, then the rest
+    size_t split = phdr_pos + 1;
+    for (size_t i = 0; i < split; i++)
+        begin_buf.append((const char*) &phdrs[i], sizeof(Elf64_Phdr));
+
+    begin_buf.append((const char*) &first_load, sizeof(Elf64_Phdr));
+
+    for (size_t i = split; i < phdrs.size(); i++)
+        begin_buf.append((const char*) &phdrs[i], sizeof(Elf64_Phdr));
+
+    // also adds offsets to section headers table, rest of the page stays hole
+    exec.prepend(std::move(begin_buf), whole_size);
+}
+
+static size_t page_down(size_t addr) {
+    return addr / getpagesize() * getpagesize();
+}
+
+static size_t page_up(size_t addr) {
+    return page_down(addr + getpagesize() - 1);
+}
+
+/**
+ * Lowest offset, not below `start`, at which `size` bytes mapped at `bias + offset`
+ * don't share a page with any of `phdrs` PT_LOADs.
+ **/
+static size_t find_free_offset(const std::vector<Elf64_Phdr>& phdrs, size_t bias, size_t start, size_t size) {
+    size_t off = start;
+    for (bool moved = true; moved; ) {
+        moved = false;
+        for (const auto& ph : phdrs) {
+            if (ph.p_type != PT_LOAD || ph.p_memsz == 0)
+                continue;
+            size_t lo = page_down(ph.p_vaddr), hi = page_up(ph.p_vaddr + ph.p_memsz);
+            if (page_down(bias + off) < hi && lo < page_up(bias + off + size)) {
+                off = hi - bias;
+                moved = true;
+            }
+        }
+    }
+    return off;
+}
+
+/**
+ * Sorts PT_LOADs of `phdrs` by p_vaddr, as gABI requires, keeping positions
+ * of other entries.
+ **/
+static void sort_loads(std::vector<Elf64_Phdr>& phdrs) {
+    std::vector<size_t> pos;
+    std::vector<Elf64_Phdr> loads;
+    for (size_t i = 0; i < phdrs.size(); i++) {
+        if (phdrs[i].p_type == PT_LOAD) {
+            pos.push_back(i);
+            loads.push_back(phdrs[i]);
+        }
+    }
+    std::stable_sort(loads.begin(), loads.end(), [](const Elf64_Phdr& a, const Elf64_Phdr& b) {
+        return a.p_vaddr < b.p_vaddr;
+    });
+    for (size_t i = 0; i < pos.size(); i++)
+        phdrs[pos[i]] = loads[i];
+}
+
+/**
+ * Writes `phdrs` (plus PT_LOAD mapping them) as program header table at the end
+ * of file, updates e_phoff and PT_PHDR.
+ **/
+static void move_phdrs_to_end(ElfImage& exec, std::vector<Elf64_Phdr> phdrs) {
+    // Kernels before 5.18 pass `first PT_LOAD's (p_vaddr - p_offset) + e_phoff` as AT_PHDR,
+    // so table is mapped at that address - just not overlapping any other segment.
+    auto first_load = std::find_if(phdrs.begin(), phdrs.end(), [](const Elf64_Phdr& ph) {
+        return ph.p_type == PT_LOAD;
+    });
+    if (first_load == phdrs.end())
+        throw std::string("Linking error: Malformed binary: no PT_LOAD in ET_EXEC file!");
+    size_t bias = first_load->p_vaddr - first_load->p_offset;
+
+    const Elf64_Ehdr& hdr = exec.header();
+    size_t tbl_size = (phdrs.size() + 1) * hdr.e_phentsize;
+    size_t start = (exec.size() + sizeof(Elf64_Addr) - 1) / sizeof(Elf64_Addr) * sizeof(Elf64_Addr);
+    size_t off = find_free_offset(phdrs, bias, start, tbl_size);
+
+    for (auto& ph : phdrs) {
+        if (ph.p_type == PT_PHDR) {
+            ph.p_offset = off;
+            ph.p_vaddr = ph.p_paddr = bias + off;
+            ph.p_filesz = ph.p_memsz = tbl_size;
+        }
+    }
+    Elf64_Phdr tbl_load {
+        .p_type = PT_LOAD,
+        .p_flags = PF_R,
+        .p_offset = off,
+        .p_vaddr = bias + off,
+        .p_paddr = bias + off,
+        .p_filesz = tbl_size,
+        .p_memsz = tbl_size,
+        .p_align = (Elf64_Xword) getpagesize(),
+    };
+    // PT_LOADs must be sorted by p_vaddr, table may land below injected segments
+    auto next_load = std::find_if(phdrs.begin(), phdrs.end(), [&](const Elf64_Phdr& ph) {
+        return ph.p_type == PT_LOAD && ph.p_vaddr > tbl_load.p_vaddr;
+    });
+    phdrs.insert(next_load, tbl_load);
+    exec.move_phdrs(phdrs, off);
+}
+
+void append_phdrs(ElfImage& exec, const std::vector<section_descr>& sections_to_move,
+                  const layout_plan& plan, size_t base_vaddr, bool reuse_notes) {
+    std::vector<Elf64_Phdr> phdrs = exec.phs();
+    std::vector<Elf64_Phdr> new_phdrs = segment_phdrs(sections_to_move, plan, base_vaddr, 0);
+
+    std::vector<size_t> free_slots;
+    for (size_t i = 0; i < phdrs.size(); i++) {
+        if (phdrs[i].p_type == PT_NULL || (reuse_notes && phdrs[i].p_type == PT_NOTE))
+            free_slots.push_back(i);
+    }
+    if (new_phdrs.size() <= free_slots.size()) {
+        // table stays in place; free slots may lie between PT_LOADs of higher
+        // vaddr (e.g. reserved ones, before table's own), so loads are re-sorted
+        std::vector<Elf64_Phdr> tbl = phdrs;
+        for (size_t i = 0; i < new_phdrs.size(); i++)
+            tbl[free_slots[i]] = new_phdrs[i];
+        sort_loads(tbl);
+        for (size_t i = 0; i < tbl.size(); i++) {
+            if (std::memcmp(&tbl[i], &phdrs[i], sizeof(Elf64_Phdr)) != 0)
+                exec.set_phdr(i, tbl[i]);
+        }
+        return;
+    }
+
+    phdrs.insert(phdrs.end(), new_phdrs.begin(), new_phdrs.end());
+    move_phdrs_to_end(exec, std::move(phdrs));
+}
+
+void reserve_phdrs(ElfImage& exec, size_t count) {
+    std::vector<Elf64_Phdr> phdrs = exec.phs();
+    size_t free_slots = std::count_if(phdrs.begin(), phdrs.end(), [](const Elf64_Phdr& ph) {
+        return ph.p_type == PT_NULL;
+    });
+    if (free_slots >= count)
+        return;
+    phdrs.resize(phdrs.size() + count - free_slots, Elf64_Phdr{});
+    move_phdrs_to_end(exec, std::move(phdrs));
+}
+
+static void omitted_relocation(const std::string& sym) {
+    std::cerr << "[INFO] omitting relocation for symbol " << sym << " (not supported type)\n";
+}
+
+// entries of one relocation section given to one task
+static const size_t RELA_CHUNK = 4096;
+
+namespace {
+
+/**
+ * Relocations [begin, end) of `target` section of `k`-th input.
+ **/
+struct rela_chunk {
+    size_t k;
+    size_t target;
+    std::string_view relas;
+};
+
+/**
+ * Everything chunk's task produces - applied in chunk order afterwards.
+ **/
+struct chunk_result {
+    std::vector<Relocator::Store> stores;
+    std::vector<std::string> omitted; // symbols of relocations of unsupported type
+    std::string error; // first one, chunk is abandoned there
+    JobCounters counters;
+};
+
+}
+
+/**
+ * Runs `fn(chunk index, relocator, result)` for `num_chunks` chunks on `threads`
+ * threads - image is only read meanwhile, relocator records stores into result.
+ * Then, in chunk order, applies stores, prints messages and throws first error,
+ * same as if relocations were applied one by one.
+ **/
+template<typename F>
+static void apply_chunks(ElfImage& exec, size_t num_chunks, size_t threads, F fn) {
+    std::vector<chunk_result> results(num_chunks);
+    JobCounters* counters = current_counters;
+    {
+        WorkerPool pool(threads);
+        for (size_t c = 0; c < num_chunks; c++) {
+            pool.submit([&, c]() {
+                chunk_result& res = results[c];
+                StatsScope scope(counters != nullptr ? &res.counters : nullptr);
+                try {
+                    Relocator relocator(exec);
+                    relocator.record(&res.stores);
+                    fn(c, relocator, res);
+                } catch (const std::string& s) {
+                    res.error = s;
+                } catch (const char* s) {
+                    res.error = s;
+                } catch (const std::exception& e) {
+                    res.error = e.what();
+                }
+            });
+        }
+        pool.wait();
+    }
+
+    for (const chunk_result& res : results) {
+        if (counters != nullptr)
+            counters->add(res.counters);
+        for (const std::string& sym : res.omitted)
+            omitted_relocation(sym);
+        if (!res.error.empty())
+            throw res.error;
+        Relocator::commit(exec, res.stores);
+    }
+}
+
+// `threads` == 0: one per core for at least PARALLEL_MIN_RELOCATIONS
+static size_t pick_threads(size_t threads, size_t count) {
+    if (threads != 0)
+        return threads;
+    // below that thread startup isn't paid back
+    return count >= PARALLEL_MIN_RELOCATIONS ? std::thread::hardware_concurrency() : 1;
+}
+
+void resolve_relocations(ElfImage& exec, const std::vector<rel_input>& rels,
+                         const SymbolIndex& exec_syms, const rel_globals& globals, const got_table& got,
+                         size_t threads) {
+    size_t s0 = exec.size();
+    std::vector<rela_chunk> chunks;
+    size_t count = 0;
+    for (size_t k = 0; k < rels.size(); k++) {
+        for_each_rela_section(rels[k], [&](size_t target, std::string_view relas) {
+            for (size_t i = 0; i < relas.size(); i += RELA_CHUNK * sizeof(Elf64_Rela))
+                chunks.push_back(rela_chunk{k, target, relas.substr(i, RELA_CHUNK * sizeof(Elf64_Rela))});
+            count += relas.size() / sizeof(Elf64_Rela);
+        });
+    }
+
+    if (pick_threads(threads, count) > 1) {
+        apply_chunks(exec, chunks.size(), pick_threads(threads, count), [&](size_t c, Relocator& relocator,
+                                                                            chunk_result& res) {
+            const rela_chunk& chunk = chunks[c];
+            for_each_rela(chunk.target, chunk.relas, [&](size_t target, const Elf64_Rela& r) {
+                rela_descr d = resolve_rela(exec, rels, chunk.k, target, r, exec_syms, globals, got);
+                if (!relocator.apply(d))
+                    res.omitted.push_back(d.symbol.second);
+            });
+        });
+        assert(s0 == exec.size());
+        return;
+    }
+
+    Relocator relocator(exec);
+
+    // resolved one by one, never all held at once
+    for (size_t k = 0; k < rels.size(); k++) {
+        for_each_rela(rels[k], [&](size_t target, const Elf64_Rela& r) {
+            rela_descr d = resolve_rela(exec, rels, k, target, r, exec_syms, globals, got);
+            if (!relocator.apply(d)) {
+                omitted_relocation(d.symbol.second);
+            }
+        });
+    }
+    assert(s0 == exec.size());
+}
+
+uint64_t plan_key(const ElfImage& exec, const std::vector<rel_input>& rels, const LinkOptions& options) {
+    PlanHasher h;
+    h.add(PLAN_VERSION);
+    h.add((uint64_t) options.huge_rx); // layout alignment
+    // dropped sections change layout
+    h.add((uint64_t) options.gc_sections);
+    for (const std::string& name : options.keep)
+        h.add(name);
+    // merged entries move with content of each other
+    h.add((uint64_t) options.merge);
+    h.add((uint64_t) options.merge_exec_rodata);
+    if (options.merge_exec_rodata && exec.has_section(".rodata"))
+        h.add(exec.section_content(".rodata"));
+    // folding depends on code bytes
+    h.add((uint64_t) options.icf);
+    // detour targets are gc roots, wrapped functions get trampolines
+    for (const detour_spec& d : options.detours) {
+        h.add(d.exec_sym);
+        h.add(d.rel_sym);
+        h.add((uint64_t) d.wrap);
+    }
+    // re-patch places segments according to previous patch
+    h.add((uint64_t) options.repatch);
+    if (options.repatch) {
+        h.add((uint64_t) options.headroom);
+        if (exec.has_section(PATCH_RECORD_SECTION))
+            h.add(exec.copy(exec.section(PATCH_RECORD_SECTION).sh_offset,
+                            exec.section(PATCH_RECORD_SECTION).sh_size));
+    }
+    h.add(&exec.header(), sizeof(Elf64_Ehdr));
+    for (const Elf64_Phdr& ph : exec.phs())
+        h.add(&ph, sizeof(ph)); // base address of layout
+    for (const auto& sec : exec.shdrs()) {
+        if (sec.first.sh_type == SHT_SYMTAB) {
+            h.add(exec.section_content(sec.first));
+            h.add(exec.section_content(exec.shdrs().at(sec.first.sh_link).first));
+        }
+    }
+
+    h.add((uint64_t) rels.size());
+    for (const rel_input& in : rels) {
+        // sizes and alignments give layout, symbol tables and relocations the rest
+        h.add((uint64_t) in.img.shdrs().size());
+        for (const auto& sec : in.img.shdrs()) {
+            h.add(&sec.first, sizeof(Elf64_Shdr));
+            h.add(sec.second);
+            Elf64_Word type = sec.first.sh_type;
+            if (type == SHT_SYMTAB || type == SHT_STRTAB || type == SHT_RELA
+                || (options.merge && (sec.first.sh_flags & SHF_MERGE))
+                || (options.icf && (sec.first.sh_flags & SHF_EXECINSTR)))
+                h.add(in.img.section_content(sec.first));
+        }
+        // relaxation depends on instruction, which isn't covered above
+        for_each_rela(in, [&](size_t target, const Elf64_Rela& r) {
+            if (is_gotpcrel(ELF64_R_TYPE(r.r_info)))
+                h.add((uint64_t) relaxable(in, target, r));
+        });
+    }
+    return h.value();
+}
+
+RelocationPlan plan_relocations(const ElfImage& exec, const std::vector<rel_input>& rels,
+                                const SymbolIndex& exec_syms, const rel_globals& globals, const got_table& got) {
+    RelocationPlan plan;
+    for (size_t k = 0; k < rels.size(); k++) {
+        for_each_rela(rels[k], [&](size_t target, const Elf64_Rela& r) {
+            plan.add(resolve_rela(exec, rels, k, target, r, exec_syms, globals, got));
+        });
+    }
+    return plan;
+}
+
+void apply_plan(ElfImage& exec, const RelocationPlan& plan, size_t threads) {
+    size_t s0 = exec.size();
+    const std::vector<planned_rela>& relas = plan.relas;
+    threads = pick_threads(threads, relas.size());
+    if (threads > 1) {
+        size_t num_chunks = (relas.size() + RELA_CHUNK - 1) / RELA_CHUNK;
+        apply_chunks(exec, num_chunks, threads, [&](size_t c, Relocator& relocator, chunk_result& res) {
+            size_t end = std::min(relas.size(), (c + 1) * RELA_CHUNK);
+            for (size_t i = c * RELA_CHUNK; i < end; i++) {
+                rela_descr d = plan.descr(relas[i]);
+                if (!relocator.apply(d))
+                    res.omitted.push_back(d.symbol.second);
+            }
+        });
+        assert(s0 == exec.size());
+        return;
+    }
+
+    Relocator relocator(exec);
+    for (const planned_rela& p : relas) {
+        rela_descr d = plan.descr(p);
+        if (!relocator.apply(d))
+            omitted_relocation(d.symbol.second);
+    }
+    assert(s0 == exec.size());
+}
+
+
+void overwrite_start(ElfImage& exec, const std::vector<rel_input>& rels,
+                     size_t start_idx, const rel_globals& globals) {
+    Elf64_Ehdr ehdr = exec.header();
+
+    auto it = globals.find("_start");
+    if (it == globals.end()) {
+        std::cerr <<  "[INFO] Lack of _start symbol in ET_REL! e_entry not overridden\n";
+        return;
+    }
+
+    const rel_input& in = rels[it->second.first];
+    size_t new_start_idx = in.moved[in.syms->at(it->second.second).st_shndx];
+    size_t new_start = moved_symbol(exec, in, it->second.second).first.st_value;
+    ehdr.e_entry = new_start;
+    exec.set_header(ehdr);
+
+    if (start_idx != SymbolIndex::npos) {
+        const Elf64_Shdr& symtab = exec.section(".symtab");
+        Elf64_Sym s; // we need to change it's offset and shndx
+        std::string entry = exec.copy(symtab.sh_offset + start_idx * sizeof(Elf64_Sym), sizeof(Elf64_Sym));
+        memcpy(&s, entry.data(), sizeof(Elf64_Sym));
+        s.st_shndx = new_start_idx;
+        s.st_value = new_start;
+
+        exec.write(symtab.sh_offset + start_idx * sizeof(Elf64_Sym), &s, sizeof(Elf64_Sym));
+    }
+}
+
+detour_site find_detour_site(const ElfImage& exec, const SymbolIndex& exec_syms, const detour_spec& spec) {
+    std::string err = "Linking error: can't detour " + spec.exec_sym + ": ";
+    size_t idx = exec_syms.find(spec.exec_sym);
+    if (idx == SymbolIndex::npos)
+        throw err + "no such symbol in ET_EXEC";
+    const Elf64_Sym& sym = exec_syms.at(idx);
+    if (ELF64_ST_TYPE(sym.st_info) != STT_FUNC || sym.st_shndx == SHN_UNDEF || sym.st_shndx >= exec.shdrs().size()
+        || !(exec.shdrs()[sym.st_shndx].first.sh_flags & SHF_EXECINSTR))
+        throw err + "not a function defined in ET_EXEC";
+    // size bounds what can be overwritten
+    if (sym.st_size < DETOUR_JUMP_SIZE)
+        throw err + "function is shorter than jump (or of unknown size)";
+
+    const Elf64_Shdr& sec = exec.shdrs()[sym.st_shndx].first;
+    if (sym.st_value < sec.sh_addr || sym.st_value + sym.st_size > sec.sh_addr + sec.sh_size)
+        throw err + "function is out of its section";
+    std::string code = exec.copy(sec.sh_offset + (sym.st_value - sec.sh_addr), sym.st_size);
+    size_t len = DETOUR_JUMP_SIZE;
+    if (spec.wrap) {
+        try {
+            len = displaced_length(code, DETOUR_JUMP_SIZE);
+        } catch (const std::string& why) {
+            throw err + "prologue can't be moved to trampoline (" + why + ")";
+        }
+    }
+    // branch of the body into overwritten bytes would land inside the jump (or padding);
+    // one to the entry itself is fine while it stays the entry
+    for (size_t off = 0; off < code.size(); ) {
+        insn_info insn = decode_insn(code.substr(off));
+        if (insn.length == 0)
+            throw err + "function body can't be decoded to check its branches";
+        if (insn.branch) {
+            int64_t target = branch_target(code, off, insn);
+            if (target >= (spec.wrap ? 0 : 1) && target < (int64_t) len)
+                throw err + "function branches back into its first " + std::to_string(len) + " bytes";
+        }
+        off += insn.length;
+    }
+    code.resize(len);
+    return detour_site{sym.st_value, std::move(code)};
+}
+
+static Elf64_Addr detour_target(const ElfImage& exec, const std::vector<rel_input>& rels, const rel_globals& globals,
+                                const detour_spec& spec) {
+    auto it = globals.find(spec.rel_sym);
+    assert(it != globals.end());
+    return moved_symbol(exec, rels[it->second.first], it->second.second).first.st_value;
+}
+
+void apply_detours(ElfImage& exec, const std::vector<rel_input>& rels, const rel_globals& globals,
+                   const std::vector<detour_spec>& detours, const std::vector<detour_site>& sites) {
+    Relocator relocator(exec);
+    for (size_t i = 0; i < detours.size(); i++) {
+        Elf64_Addr to = detour_target(exec, rels, globals, detours[i]);
+        std::string jump;
+        try {
+            jump = detour_jump(sites[i].vaddr, to, sites[i].prologue.size());
+        } catch (const std::string& why) {
+            throw "Linking error: can't detour " + detours[i].exec_sym + ": " + why;
+        }
+        exec.write(relocator.vaddr2off(sites[i].vaddr), jump.data(), jump.size());
+    }
+}
+
+size_t rewrite_call_sites(ElfImage& exec, const ElfImage& orig, const SymbolIndex& exec_syms,
+                          const std::vector<rel_input>& rels, const rel_globals& globals,
+                          const std::vector<detour_spec>& detours, const std::vector<detour_site>& sites) {
+    // entry of detoured function -> replacement
+    std::unordered_map<Elf64_Addr, Elf64_Addr> targets;
+    for (size_t i = 0; i < detours.size(); i++)
+        targets.emplace(sites[i].vaddr, detour_target(exec, rels, globals, detours[i]));
+    auto overwritten = [&](Elf64_Addr vaddr, size_t size) {
+        for (const detour_site& site : sites) {
+            if (vaddr < site.vaddr + site.prologue.size() && site.vaddr < vaddr + size)
+                return true;
+        }
+        return false;
+    };
+
+    // aliases decode the same code, each site is taken once
+    std::map<Elf64_Addr, Elf64_Addr> calls;
+    for (size_t idx = 0; idx < exec_syms.size(); idx++) {
+        const Elf64_Sym& sym = exec_syms.at(idx);
+        if (ELF64_ST_TYPE(sym.st_info) != STT_FUNC || sym.st_size == 0 || sym.st_shndx == SHN_UNDEF
+            || sym.st_shndx >= orig.shdrs().size())
+            continue;
+        const Elf64_Shdr& sec = orig.shdrs()[sym.st_shndx].first;
+        if (!(sec.sh_flags & SHF_EXECINSTR) || sec.sh_type != SHT_PROGBITS || sym.st_value < sec.sh_addr
+            || sym.st_value + sym.st_size > sec.sh_addr + sec.sh_size)
+            continue;
+
+        std::string_view code = orig.section_content(sec).substr(sym.st_value - sec.sh_addr, sym.st_size);
+        // boundaries are known only up to the first unknown instruction
+        for (size_t off = 0; off < code.size(); ) {
+            insn_info insn = decode_insn(code.substr(off));
+            if (insn.length == 0)
+                break;
+            unsigned char op = code[off];
+            if (insn.length == DETOUR_JUMP_SIZE && (op == 0xe8 || op == 0xe9)) {
+                Elf64_Addr site = sym.st_value + off;
+                auto it = targets.find(sym.st_value + branch_target(code, off, insn));
+                if (it != targets.end() && !overwritten(site, DETOUR_JUMP_SIZE))
+                    calls.emplace(site, it->second);
+            }
+            off += insn.length;
+        }
+    }
+
+    Relocator relocator(exec);
+    size_t count = 0;
+    for (auto& call : calls) {
+        int64_t rel = (int64_t) (call.second - (call.first + DETOUR_JUMP_SIZE));
+        if (rel != (int32_t) rel)
+            continue;
+        int32_t rel32 = rel;
+        exec.write(relocator.vaddr2off(call.first + 1), &rel32, sizeof(rel32));
+        count++;
+    }
+    return count;
+}
+
+
+void link(const ExecInput& exec_in, const LinkJob& job, LinkStats* stats) {
+    StatsScope scope(stats != nullptr ? &stats->counters : current_counters);
+    using clock = std::chrono::steady_clock;
+    auto t0 = clock::now();
+    auto phase_done = [&](const char* name) {
+        if (stats == nullptr)
+            return;
+        auto t1 = clock::now();
+        stats->phases.emplace_back(name, std::chrono::duration<double>(t1 - t0).count());
+        t0 = t1;
+    };
+
+    // ET_RELs are read section by section
+    std::vector<ElfView> rel_views;
+    for (const auto& fname : job.rel_fnames) {
+        rel_views.push_back(open_input(fname, MADV_WILLNEED));
+        check_input(rel_views.back(), fname);
+    }
+
+    // same inputs and options always give the same bytes, so they can be cached
+    const LinkOptions& opts = job.options;
+    std::string cached;
+    if (!opts.cache_dir.empty()) {
+        cached = cache_entry(opts.cache_dir, output_key(exec_in, rel_views, opts));
+        if (place_file(cached, job.out_fname, opts.cache_hardlink)) {
+            if (current_counters != nullptr)
+                current_counters->cache_hits++;
+            phase_done("cache");
+            return;
+        }
+    }
+
+    // prefix doesn't depend on ET_EXEC's bulk, stacked patches still get different ones
+    std::string prefix = hash_string(inputs_digest(exec_in.img, rel_views), 5);
+
+    // output image - views shared ET_EXEC, copies only what gets modified
+    ElfImage exec{exec_in.img};
+
+    // previous patch is taken back, its space and program headers get reused
+    patch_record prev;
+    bool repatching = opts.repatch && read_patch_record(exec, prev);
+    if (repatching)
+        strip_patch(exec, prev);
+    else if (opts.repatch)
+        reserve_phdrs(exec, MAX_SEGMENTS); // table lands before layout, cutting file never drops it
+
+    // functions are checked before anything is done, wrapped ones get trampolines
+    std::vector<detour_site> detour_sites;
+    std::vector<trampoline> trampolines;
+    for (const detour_spec& d : opts.detours) {
+        detour_sites.push_back(find_detour_site(exec_in.img, exec_in.syms(), d));
+        for (size_t i = 0; i + 1 < detour_sites.size(); i++) {
+            if (detour_sites[i].vaddr == detour_sites.back().vaddr)
+                throw "Linking error: " + d.exec_sym + " is detoured twice";
+        }
+        if (d.wrap)
+            trampolines.push_back(trampoline{d.exec_sym, detour_sites.back().vaddr, detour_sites.back().prologue});
+    }
+    std::vector<std::string_view> rel_contents;
+    for (const ElfView& view : rel_views)
+        rel_contents.push_back(view.view());
+    // linked as one more ET_REL, which `rels` view
+    std::string trampoline_obj;
+    if (!trampolines.empty()) {
+        trampoline_obj = trampoline_object(trampolines);
+        rel_contents.push_back(trampoline_obj);
+    }
+
+    std::vector<rel_input> rels;
+    for (size_t k = 0; k < rel_contents.size(); k++) {
+        ElfImage img{rel_contents[k]};
+        auto syms = std::make_unique<SymbolIndex>(img);
+        std::vector<size_t> moved(img.shdrs().size(), 0);
+        rels.push_back(rel_input{std::move(img), std::move(syms), prefix + std::to_string(k), std::move(moved), {}, {}});
+    }
+
+    rel_globals globals = collect_rel_globals(rels);
+    for (const detour_spec& d : opts.detours) {
+        if (!globals.count(d.rel_sym))
+            throw "Linking error: detour target " + d.rel_sym + " is not defined in ET_REL files";
+    }
+
+    // plan may make ET_EXEC's symbol index unnecessary, otherwise it's part of reading
+    if (job.options.apply_plan.empty())
+        exec_in.syms();
+    phase_done("read");
+
+    // unreachable sections are neither moved nor relocated
+    std::vector<std::vector<bool>> live;
+    if (opts.gc_sections) {
+        // detour targets are entered from ET_EXEC
+        std::vector<std::string> roots = opts.keep;
+        for (const detour_spec& d : opts.detours)
+            roots.push_back(d.rel_sym);
+        live = live_sections(rels, globals, roots);
+    }
+    phase_done("gc");
+
+    // identical code is moved once, symbols of folded copies point to the kept one
+    std::map<rel_section, rel_section> folded;
+    if (opts.icf) {
+        std::vector<rel_section> candidates;
+        for (size_t k = 0; k < rels.size(); k++) {
+            for (size_t i = 0; i < rels[k].img.shdrs().size(); i++) {
+                const Elf64_Shdr& hdr = rels[k].img.shdrs()[i].first;
+                if ((hdr.sh_flags & (SHF_ALLOC | SHF_EXECINSTR | SHF_WRITE)) == (SHF_ALLOC | SHF_EXECINSTR)
+                    && hdr.sh_type == SHT_PROGBITS && (live.empty() || live[k][i])
+                    && !(opts.merge && merge_candidate(rels[k], i)))
+                    candidates.emplace_back(k, i);
+            }
+        }
+        folded = fold_identical(rels, globals, candidates, opts.merge);
+    }
+    phase_done("icf");
+
+    // all inputs are laid out together, one after another
+    std::vector<section_descr> sections_to_move;
+    std::vector<rel_section> sources; // of sections_to_move moved as they are, they go first
+    size_t first_moved = exec.shdrs().size();
+    // SHF_MERGE sections of one kind (flags, entry size, alignment) -> (input, section index)
+    std::map<std::tuple<uint64_t, uint64_t, uint64_t>, std::vector<std::pair<size_t, size_t>>> merge_groups;
+    for (size_t k = 0; k < rels.size(); k++) {
+        rel_input& in = rels[k];
+        for (size_t i = 0; i < in.img.shdrs().size(); i++) {
+            const Elf64_Shdr& hdr = in.img.shdrs()[i].first;
+            if ((hdr.sh_flags & SHF_ALLOC) && (live.empty() || live[k][i])) {
+                if (opts.merge && merge_candidate(in, i)) {
+                    merge_groups[std::make_tuple(hdr.sh_flags, hdr.sh_entsize, hdr.sh_addralign)].emplace_back(k, i);
+                    continue;
+                }
+                if (folded.count(std::make_pair(k, i)))
+                    continue;
+                in.moved[i] = first_moved + sections_to_move.size();
+                sections_to_move.push_back(std::make_pair(hdr, in.prefix + in.img.shdrs()[i].second));
+                sources.emplace_back(k, i);
+            }
+        }
+    }
+
+    for (auto& fold : folded) {
+        rel_input& in = rels[fold.first.first];
+        in.moved[fold.first.second] = rels[fold.second.first].moved[fold.second.second];
+        in.folded.insert(fold.first.second);
+        if (current_counters != nullptr)
+            current_counters->bytes_folded += in.img.shdrs()[fold.first.second].first.sh_size;
+    }
+
+    // each kind becomes one section, with equal entries (and tails of strings) stored once
+    // bytes are taken at layout, merged sections only have theirs already
+    std::vector<std::string> moved_sections_contents(sections_to_move.size());
+    std::unique_ptr<RodataIndex> exec_rodata;
+    if (opts.merge_exec_rodata && exec_in.img.has_section(".rodata")) {
+        const Elf64_Shdr& rodata = exec_in.img.section(".rodata");
+        exec_rodata = std::make_unique<RodataIndex>(exec_in.img.section_content(rodata), rodata.sh_addr);
+    }
+    for (auto& group : merge_groups) {
+        std::vector<merge_input> inputs;
+        size_t input_size = 0;
+        for (auto [k, i] : group.second) {
+            const Elf64_Shdr& hdr = rels[k].img.shdrs()[i].first;
+            inputs.push_back(merge_input{&hdr, rels[k].img.section_content(hdr)});
+            input_size += hdr.sh_size;
+        }
+        merged_section merged = merge_sections(inputs, exec_rodata.get());
+        if (current_counters != nullptr)
+            current_counters->bytes_merged += input_size - merged.content.size();
+
+        auto [k0, i0] = group.second.front();
+        for (size_t j = 0; j < group.second.size(); j++) {
+            rel_input& in = rels[group.second[j].first];
+            in.moved[group.second[j].second] = first_moved + sections_to_move.size();
+            in.merged.emplace(group.second[j].second, std::move(merged.maps[j]));
+        }
+        sections_to_move.push_back(std::make_pair(merged.hdr, prefix + rels[k0].img.shdrs()[i0].second));
+        count_copied(merged.content.size());
+        moved_sections_contents.push_back(std::move(merged.content));
+    }
+
+    phase_done("merge");
+
+    for (size_t j = 0; j < sources.size(); j++) {
+        const Elf64_Shdr& hdr = sections_to_move[j].first;
+        // NOBITS has no bytes in ET_REL, it's only memory
+        if (hdr.sh_type != SHT_NOBITS)
+            moved_sections_contents[j] = std::string(rels[sources[j].first].img.section_content(hdr));
+        count_copied(moved_sections_contents[j].size());
+    }
+
+    // slots for GOT-relative relocations that can't be relaxed (or maybe can't
+    // reach their target when relaxed), mapped with RW sections
+    got_table got = collect_got_slots(rels, globals);
+    size_t got_idx = sections_to_move.size();
+    if (!got.slots.empty()) {
+        Elf64_Shdr hdr{};
+        hdr.sh_type = SHT_PROGBITS;
+        hdr.sh_flags = SHF_ALLOC | SHF_WRITE;
+        hdr.sh_size = got.slots.size() * sizeof(Elf64_Addr);
+        hdr.sh_addralign = sizeof(Elf64_Addr);
+        sections_to_move.push_back(std::make_pair(hdr, prefix + ".got"));
+        moved_sections_contents.push_back(std::string(hdr.sh_size, '\0'));
+    }
+
+    // at most one PT_LOAD per permissions set
+    layout_plan plan = plan_layout(sections_to_move, opts.huge_rx, opts.repatch ? opts.headroom : 0);
+    // segments stay at their addresses while they fit
+    bool pinned = repatching && pin_layout(plan, prev.slots);
+    if (repatching && !pinned)
+        std::cerr << "[INFO] injected code outgrew its headroom, segments are moved\n";
+    size_t head_size = job.options.prepend_phdrs ? compute_head_size(exec, plan) : 0;
+    size_t base_vaddr = compute_base_vaddr(exec, plan.size, plan.align);
+    phase_done("layout");
+
+    Elf64_Addr orig_entry = exec.header().e_entry;
+    Elf64_Shdr orig_shstrtab = exec.section(".shstrtab");
+    size_t region_off = SE::append_sections(exec, sections_to_move, std::move(moved_sections_contents),
+                                            plan, base_vaddr, head_size);
+    if (!got.slots.empty())
+        got.vaddr = sections_to_move[got_idx].first.sh_addr;
+    phase_done("append_sections");
+
+    // names are already prefixed
+    std::vector<section_descr> named = sections_to_move;
+    if (opts.repatch) {
+        patch_record rec;
+        rec.orig_entry = orig_entry;
+        rec.orig_shnum = first_moved;
+        rec.orig_shstrtab = orig_shstrtab;
+        rec.patch_shnum = first_moved + sections_to_move.size() + 1;
+        rec.region_off = region_off;
+        rec.region_vaddr = base_vaddr;
+        rec.region_size = plan.size;
+        rec.slots = pinned ? prev.slots : layout_slots(plan);
+
+        Elf64_Shdr hdr{};
+        hdr.sh_type = SHT_PROGBITS;
+        hdr.sh_addralign = sizeof(Elf64_Addr);
+        SE::append_section(exec, hdr, rec.serialize());
+        named.push_back(std::make_pair(hdr, PATCH_RECORD_SECTION));
+    }
+    // ET_EXEC's own .shstrtab must survive for the next re-patch
+    SE::add_moved_section_names(exec, named, "", !opts.repatch);
+    phase_done("add_moved_section_names");
+
+    if (job.options.prepend_phdrs) {
+        rewrite_phdrs(exec, sections_to_move, plan, base_vaddr);
+    } else {
+        append_phdrs(exec, sections_to_move, plan, base_vaddr, job.options.reuse_notes);
+    }
+    phase_done("phdrs");
+
+    // symbol values don't depend on layout, so shared ET_EXEC's index can be used
+    size_t start_idx;
+    if (opts.apply_plan.empty() && opts.save_plan.empty()) {
+        resolve_relocations(exec, rels, exec_in.syms(), globals, got, opts.reloc_threads);
+        start_idx = exec_in.syms().find("_start");
+    } else {
+        // ET_EXEC's symbols are hashed instead of indexed, plan hit never builds the index
+        uint64_t key = plan_key(exec_in.img, rels, opts);
+        RelocationPlan plan;
+        bool hit = !opts.apply_plan.empty() && plan.load(opts.apply_plan, key);
+        if (!hit && !opts.apply_plan.empty())
+            std::cerr << "[INFO] relocation plan " << opts.apply_plan << " is missing or stale, resolving symbols\n";
+
+        if (hit) {
+            apply_plan(exec, plan, opts.reloc_threads);
+        } else if (opts.save_plan.empty()) {
+            resolve_relocations(exec, rels, exec_in.syms(), globals, got, opts.reloc_threads);
+        } else {
+            plan = plan_relocations(exec, rels, exec_in.syms(), globals, got);
+            plan.key = key;
+            plan.start_idx = exec_in.syms().find("_start");
+            apply_plan(exec, plan, opts.reloc_threads);
+        }
+        start_idx = hit || !opts.save_plan.empty() ? plan.start_idx : exec_in.syms().find("_start");
+        if (!opts.save_plan.empty() && !(hit && opts.save_plan == opts.apply_plan))
+            plan.save(opts.save_plan);
+    }
+    phase_done("resolve_relocations");
+
+    // with `--repatch`, ET_EXEC's `_start` keeps pointing to original code, as
+    // `orig_start` of the next patch
+    overwrite_start(exec, rels, opts.repatch ? SymbolIndex::npos : start_idx, globals);
+    phase_done("overwrite_start");
+
+    apply_detours(exec, rels, globals, opts.detours, detour_sites);
+    if (opts.rewrite_calls) {
+        size_t rewritten = rewrite_call_sites(exec, exec_in.img, exec_in.syms(), rels, globals,
+                                              opts.detours, detour_sites);
+        if (current_counters != nullptr)
+            current_counters->call_sites_rewritten += rewritten;
+        std::cerr << "[INFO] " << rewritten << " call site(s) rewritten to detour targets\n";
+    }
+    phase_done("detours");
+
+    // original bytes stay in place (unless prepended), so only delta is written
+    write_file(exec.content(), job.out_fname, &exec_in.view, job.options.clone_output);
+    if (!cached.empty()) {
+        // output is already in place, cache is only an optimization
+        try {
+            mkdir(opts.cache_dir.c_str(), 0755);
+            place_file(job.out_fname, cached, opts.cache_hardlink);
+        } catch (const std::string& err) {
+            std::cerr << "[INFO] output not cached: " << err << "\n";
+        }
+    }
+    phase_done("dump");
+}
+
+static std::string reloc_type_name(unsigned type) {
+    switch (type) {
+    case R_X86_64_64: return "R_X86_64_64";
+    case R_X86_64_PC32: return "R_X86_64_PC32";
+    case R_X86_64_PLT32: return "R_X86_64_PLT32";
+    case R_X86_64_32: return "R_X86_64_32";
+    case R_X86_64_32S: return "R_X86_64_32S";
+    case R_X86_64_PC64: return "R_X86_64_PC64";
+    case R_X86_64_GOTPCREL: return "R_X86_64_GOTPCREL";
+    case R_X86_64_GOTPCRELX: return "R_X86_64_GOTPCRELX";
+    case R_X86_64_REX_GOTPCRELX: return "R_X86_64_REX_GOTPCRELX";
+    case R_X86_64_NUM: return "other";
+    default: return "type_" + std::to_string(type);
+    }
+}
+
+static std::string json_string(const std::string& s) {
+    std::string res = "\"";
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            res += '\\';
+            res += c;
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            res += buf;
+        } else {
+            res += c;
+        }
+    }
+    return res + "\"";
+}
+
+std::string stats_report(const LinkJob& job, const LinkStats& stats, StatsFormat format) {
+    const JobCounters& c = stats.counters;
+    double total = 0;
+    for (const auto& phase : stats.phases)
+        total += phase.second;
+
+    std::ostringstream out;
+    if (format == StatsFormat::json) {
+        out << "{\"exec\":" << json_string(job.exec_fname) << ",\"rels\":[";
+        for (size_t i = 0; i < job.rel_fnames.size(); i++)
+            out << (i ? "," : "") << json_string(job.rel_fnames[i]);
+        out << "],\"out\":" << json_string(job.out_fname) << ",\"phases_ms\":{";
+        for (size_t i = 0; i < stats.phases.size(); i++)
+            out << (i ? "," : "") << "\"" << stats.phases[i].first << "\":" << stats.phases[i].second * 1000;
+        out << "},\"total_ms\":" << total * 1000
+            << ",\"allocations\":" << c.allocations << ",\"allocated_bytes\":" << c.allocated_bytes
+            << ",\"bytes_copied\":" << c.bytes_copied << ",\"bytes_written\":" << c.bytes_written
+            << ",\"bytes_copied_in_kernel\":" << c.bytes_copied_in_kernel << ",\"bytes_cloned\":" << c.bytes_cloned
+            << ",\"symbol_lookups\":" << c.symbol_lookups << ",\"cache_hits\":" << c.cache_hits
+            << ",\"bytes_merged\":" << c.bytes_merged << ",\"bytes_folded\":" << c.bytes_folded
+            << ",\"call_sites_rewritten\":" << c.call_sites_rewritten
+            << ",\"relocations\":{";
+        bool first = true;
+        for (unsigned type = 0; type <= R_X86_64_NUM; type++) {
+            if (c.relocations[type] == 0)
+                continue;
+            out << (first ? "" : ",") << "\"" << reloc_type_name(type) << "\":" << c.relocations[type];
+            first = false;
+        }
+        out << "},\"relocations_skipped\":" << c.relocations_skipped
+            << ",\"peak_rss_kb\":" << stats.peak_rss_kb << "}\n";
+        return out.str();
+    }
+
+    out << "[STATS] " << job.out_fname << "\n[STATS] phases [ms]:";
+    for (const auto& phase : stats.phases)
+        out << " " << phase.first << " " << phase.second * 1000 << ",";
+    out << " total " << total * 1000 << "\n"
+        << "[STATS] allocations: " << c.allocations << " (" << c.allocated_bytes << " bytes)\n"
+        << "[STATS] bytes copied: " << c.bytes_copied << ", written: " << c.bytes_written
+        << ", copied in kernel: " << c.bytes_copied_in_kernel << ", cloned: " << c.bytes_cloned << "\n"
+        << "[STATS] symbol lookups: " << c.symbol_lookups << "\n"
+        << "[STATS] output cache hits: " << c.cache_hits << "\n"
+        << "[STATS] bytes merged away: " << c.bytes_merged << ", folded: " << c.bytes_folded << "\n"
+        << "[STATS] call sites rewritten: " << c.call_sites_rewritten
+        << "\n[STATS] relocations:";
+    for (unsigned type = 0; type <= R_X86_64_NUM; type++) {
+        if (c.relocations[type] > 0)
+            out << " " << reloc_type_name(type) << " " << c.relocations[type] << ",";
+    }
+    out << " skipped " << c.relocations_skipped << "\n"
+        << "[STATS] peak RSS: " << stats.peak_rss_kb << " KB\n";
+    return out.str();
+}
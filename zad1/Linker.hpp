@@ -0,0 +1,355 @@
+#pragma once
+
+#include <elf.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ElfView.hpp"
+#include "ElfImage.hpp"
+#include "SymbolIndex.hpp"
+#include "Relocator.hpp"
+#include "RelocationPlan.hpp"
+#include "Layout.hpp"
+#include "Merge.hpp"
+#include "Detour.hpp"
+#include "OutputCache.hpp"
+#include "PatchRecord.hpp"
+#include "Stats.hpp"
+
+enum class StatsFormat { none, text, json };
+
+/**
+ * Optional behaviour, given as `--flags` before input files.
+ **/
+struct LinkOptions {
+    bool huge_rx = false; // --huge-rx: RX segment aligned and padded to 2MB huge pages
+    bool prepend_phdrs = false; // --prepend-phdrs: new headers page inserted at the beginning
+    bool reuse_notes = false; // --reuse-notes: PT_NOTE entries may be replaced by new PT_LOADs
+    bool clone_output = true; // --no-clone: output written piece by piece, not cloned from ET_EXEC
+    StatsFormat stats = StatsFormat::none; // --stats[=json]: report of phase times and counters
+    size_t reloc_threads = 0; // --reloc-threads=N: threads applying relocations, 0 - one per core for big inputs
+    std::string save_plan; // --save-plan=FILE: resolved relocations are saved there
+    std::string apply_plan; // --apply-plan=FILE: relocations replayed from there, if inputs match
+    bool repatch = false; // --repatch: previous patch (of this mode) is replaced, not stacked
+    size_t headroom = 64 << 10; // --headroom=SIZE: free space behind every segment in re-patch mode
+    std::string cache_dir; // --cache-dir=DIR: outputs stored there by hash of inputs and options
+    bool cache_hardlink = false; // --cache-hardlink: outputs and cache entries may share inodes
+    bool gc_sections = false; // --gc-sections: only sections reachable from `_start` are moved
+    std::vector<std::string> keep; // --keep=SYM: more roots of --gc-sections
+    bool merge = true; // --no-merge: SHF_MERGE sections are moved as they are, duplicates included
+    bool merge_exec_rodata = false; // --merge-exec-rodata: merged entries ET_EXEC's .rodata has point there
+    bool icf = false; // --icf: identical code sections are moved once
+    std::vector<detour_spec> detours; // --detour=EXEC=REL, --wrap=EXEC=REL: ET_EXEC's functions jump to ET_RELs'
+    bool rewrite_calls = false; // --rewrite-calls: direct calls to detoured functions go straight to ET_RELs'
+};
+
+/**
+ * One postlinker run: ET_EXEC, any number of ET_RELs and output file.
+ **/
+struct LinkJob {
+    std::string exec_fname;
+    std::vector<std::string> rel_fnames;
+    std::string out_fname;
+    LinkOptions options;
+};
+
+/**
+ * Job from command line arguments (without program name):
+ * `[options] <ET_EXEC file> <ET_REL file>... <target ET_EXEC file>`.
+ * Throws std::string on error.
+ **/
+LinkJob parse_job(const std::vector<std::string>& args);
+
+/**
+ * Opened, checked and parsed ET_EXEC input.
+ * Never modified, so it can be shared by many jobs (and threads) -
+ * output image of each job views its content.
+ * Constructor throws std::string on error.
+ **/
+struct ExecInput {
+    ElfView view;
+    ElfImage img;
+
+    explicit ExecInput(const std::string& fname);
+
+    /**
+     * Index of .symtab, built by first job that needs it (jobs replaying
+     * relocation plan don't). Throws std::string if there is no .symtab.
+     **/
+    const SymbolIndex& syms() const;
+
+    /**
+     * Whole content hashed (see `hash_file`) by first job that needs it.
+     * Throws std::string on read error.
+     **/
+    const CacheHasher& content_hash() const;
+
+private:
+    mutable std::once_flag syms_once;
+    mutable std::unique_ptr<SymbolIndex> syms_index;
+    mutable std::once_flag hash_once;
+    mutable CacheHasher hash;
+};
+
+/**
+ * One of ET_REL files being linked.
+ **/
+struct rel_input {
+    ElfImage img;
+    std::unique_ptr<SymbolIndex> syms;
+    std::string prefix; // sections moved to ET_EXEC are named `prefix + name`
+    std::vector<size_t> moved; // ET_REL section index -> ET_EXEC section index, 0 if not moved
+    std::unordered_map<size_t, merge_map> merged; // ET_REL section index -> where its entries went
+    std::unordered_set<size_t> folded; // ET_REL section indexes moved as their identical copy, not relocated
+};
+
+/**
+ * Section of ET_REL inputs: input number, section index.
+ **/
+using rel_section = std::pair<size_t, size_t>;
+
+/**
+ * Defined, non-local symbols of all ET_REL inputs:
+ * name -> (input number, .symtab index).
+ **/
+using rel_globals = std::unordered_map<std::string, std::pair<size_t, size_t>>;
+
+/**
+ * `length` letters and digits derived from `h`.
+ **/
+std::string hash_string(uint64_t h, size_t length);
+
+/**
+ * Hash of ET_RELs' content and ET_EXEC's headers and tables (not its bulk) -
+ * prefix of moved sections is derived from it, so output doesn't change
+ * between runs, and stacked patches still get different prefixes.
+ **/
+uint64_t inputs_digest(const ElfImage& exec, const std::vector<ElfView>& rel_views);
+
+/**
+ * Version of output format, part of output cache key.
+ **/
+const uint64_t CACHE_VERSION = 2;
+
+/**
+ * Key of output cache entry: hash of whole ET_EXEC and ET_RELs and of options
+ * that change output bytes.
+ **/
+CacheKey output_key(const ExecInput& exec, const std::vector<ElfView>& rel_views, const LinkOptions& options);
+
+rel_globals collect_rel_globals(const std::vector<rel_input>& rels);
+
+/**
+ * Synthesized GOT for GOT-relative relocations that can't be relaxed.
+ * Slots are keyed by symbol: name if it's undefined in its ET_REL
+ * (resolved by name), `prefix:index` otherwise.
+ **/
+struct got_table {
+    std::unordered_map<std::string, size_t> slots; // key -> slot number
+    size_t vaddr = 0; // known once sections are appended
+
+    size_t slot_vaddr(const std::string& key) const { return vaddr + slots.at(key) * sizeof(Elf64_Addr); }
+};
+
+/**
+ * Sections (per input, per section index) reachable through relocations from
+ * sections defining `_start`, `keep` symbols, or marked SHF_GNU_RETAIN.
+ * Symbols undefined in their ET_REL lead to the ET_REL defining them.
+ * Returns empty vector (everything is live) if there is no root.
+ **/
+std::vector<std::vector<bool>> live_sections(const std::vector<rel_input>& rels, const rel_globals& globals,
+                                             const std::vector<std::string>& keep);
+
+/**
+ * Whether section `shndx` of `in` is merged with others of its kind: loadable
+ * SHF_MERGE section splittable into entries, not relocated itself.
+ **/
+bool merge_candidate(const rel_input& in, size_t shndx);
+
+/**
+ * Identical code folding of `candidates`: sections with equal flags, alignment,
+ * bytes and relocations (offset, type, addend and target) form a class. Targets
+ * are equal when they are the same symbol (by name, if ET_EXEC's), the same
+ * entry of merged sections (with `merge`), or the same offset of candidates of one
+ * class - classes are split until that holds, so mutually recursive copies fold too.
+ * Returns folded section -> the first one of its class, which is kept.
+ **/
+std::map<rel_section, rel_section> fold_identical(const std::vector<rel_input>& rels, const rel_globals& globals,
+                                                  const std::vector<rel_section>& candidates, bool merge);
+
+/**
+ * Slots needed by `rels`, before layout (it gets own section in RW segment):
+ * for GOT-relative relocations that can't be relaxed, and for relaxable ones
+ * against ET_EXEC's or absolute symbols, which may be out of reach of injected
+ * code - whether they are relaxed is decided once addresses are known.
+ **/
+got_table collect_got_slots(const std::vector<rel_input>& rels, const rel_globals& globals);
+
+/**
+ * Returns symbol defined in ET_REL with value being its final vaddr in ET_EXEC.
+ * Symbol in merged section gets vaddr of its entry.
+ **/
+symbol_descr moved_symbol(const ElfImage& exec, const rel_input& in, size_t sym_idx);
+
+/**
+ * Relocations of `k`-th input, with resolved symbols.
+ * Symbols not defined in it are searched in other inputs first, then in ET_EXEC.
+ **/
+std::vector<rela_descr> get_rela_entries(const ElfImage& exec, const std::vector<rel_input>& rels, size_t k,
+                                         const SymbolIndex& exec_syms, const rel_globals& globals,
+                                         const got_table& got);
+
+/**
+ * Lowest address, aligned to 2MB and `align`, above all ET_EXEC's PT_LOADs,
+ * where `size` bytes fit. Layout of moved sections is mapped there, independently
+ * of its file offset - so it stays close to ET_EXEC's code even behind gigabytes
+ * of file. Program header table's own PT_LOAD (mapped at its file offset, see
+ * `append_phdrs`) is only kept out of the way, layout goes below it if it fits.
+ **/
+size_t compute_base_vaddr(const ElfImage& exec, size_t size = 0, size_t align = 1);
+
+/**
+ * Size of page(s) with new ELF header and program header table,
+ * inserted at the beginning of file by `rewrite_phdrs`.
+ **/
+size_t compute_head_size(const ElfImage& exec, const layout_plan& plan);
+
+/**
+ * PT_LOADs for segments of `plan`, sections must be already appended.
+ * `shift` bytes are going to be inserted at the beginning of file.
+ **/
+std::vector<Elf64_Phdr> segment_phdrs(const std::vector<section_descr>& sections_to_move,
+                                      const layout_plan& plan, size_t base_vaddr, size_t shift);
+
+/**
+ * Inserts new ELF header and program header table (with PT_LOAD for every segment
+ * of `plan`) at the beginning of file. Sections must be already appended.
+ * Every byte of file is shifted.
+ **/
+void rewrite_phdrs(ElfImage& exec, const std::vector<section_descr>& sections_to_move,
+                   const layout_plan& plan, size_t base_vaddr);
+
+/**
+ * Adds PT_LOAD for every segment of `plan` without moving any original byte.
+ * If there are enough PT_NULL (and with `reuse_notes` PT_NOTE) entries, they are
+ * replaced. Otherwise program header table is written at the end of file, into
+ * its own PT_LOAD, and e_phoff and PT_PHDR are updated.
+ **/
+void append_phdrs(ElfImage& exec, const std::vector<section_descr>& sections_to_move,
+                  const layout_plan& plan, size_t base_vaddr, bool reuse_notes);
+
+/**
+ * Makes sure program header table has `count` PT_NULL entries: if not, it is
+ * written at the end of file with new ones added, as in `append_phdrs`.
+ **/
+void reserve_phdrs(ElfImage& exec, size_t count);
+
+/**
+ * Number of relocations from which `resolve_relocations` goes parallel by default.
+ **/
+const size_t PARALLEL_MIN_RELOCATIONS = 1 << 16;
+
+/**
+ * Resolves and applies relocations of all `rels`. With `threads` > 1, relocation
+ * sections are split into chunks resolved concurrently (image is only read then),
+ * and their stores, messages and first error are taken in chunk order - output
+ * is the same as with one thread. `threads` == 0 picks one per core when there are
+ * at least PARALLEL_MIN_RELOCATIONS relocations, one otherwise.
+ **/
+void resolve_relocations(ElfImage& exec, const std::vector<rel_input>& rels,
+                         const SymbolIndex& exec_syms, const rel_globals& globals, const got_table& got,
+                         size_t threads = 1);
+
+/**
+ * Version of relocation plan content, part of its key.
+ **/
+const uint64_t PLAN_VERSION = 3;
+
+/**
+ * Key of relocation plan: hash of everything resolved values depend on -
+ * ET_EXEC's headers and symbol table, and ET_RELs' section headers, symbol
+ * and string tables, relocations (and whether GOT-relative ones are relaxable),
+ * plus layout and detour options. Content of moved sections is not included (except merged
+ * ones, which give offsets of entries), so plan survives rebuilds that don't
+ * change sizes, symbols or relocations.
+ **/
+uint64_t plan_key(const ElfImage& exec, const std::vector<rel_input>& rels, const LinkOptions& options);
+
+/**
+ * Planning stage of `resolve_relocations`: all relocations of `rels` with
+ * resolved symbols, without applying them. Key is left for the caller.
+ **/
+RelocationPlan plan_relocations(const ElfImage& exec, const std::vector<rel_input>& rels,
+                                const SymbolIndex& exec_syms, const rel_globals& globals, const got_table& got);
+
+/**
+ * Applies relocations of `plan` (no symbol is looked up), `threads` as
+ * in `resolve_relocations`.
+ **/
+void apply_plan(ElfImage& exec, const RelocationPlan& plan, size_t threads = 1);
+
+/**
+ * Sets e_entry (and `start_idx` entry of ET_EXEC's .symtab, unless npos) to
+ * `_start` of ET_RELs, if there is one.
+ **/
+void overwrite_start(ElfImage& exec, const std::vector<rel_input>& rels,
+                     size_t start_idx, const rel_globals& globals);
+
+/**
+ * Entry of detoured ET_EXEC's function: its vaddr and bytes the jump replaces.
+ **/
+struct detour_site {
+    Elf64_Addr vaddr;
+    std::string prologue;
+};
+
+/**
+ * Site of ET_EXEC's function detoured by `spec`. Bytes the jump replaces are
+ * displaced prologue of wrapped one (see `displaced_length`), first
+ * DETOUR_JUMP_SIZE bytes otherwise. Throws std::string if the function isn't
+ * defined, is shorter than the jump (or of unknown size), its body can't be
+ * decoded or branches back into the replaced bytes, or, when wrapped, its
+ * prologue can't be moved.
+ **/
+detour_site find_detour_site(const ElfImage& exec, const SymbolIndex& exec_syms, const detour_spec& spec);
+
+/**
+ * Writes jump from every site to its `rel_sym` (defined in one of `rels`),
+ * after sections are appended.
+ **/
+void apply_detours(ElfImage& exec, const std::vector<rel_input>& rels, const rel_globals& globals,
+                   const std::vector<detour_spec>& detours, const std::vector<detour_site>& sites);
+
+/**
+ * Rewrites `call rel32` and `jmp rel32` of ET_EXEC's code targeting entries of
+ * `sites` to go straight to their `rel_sym`, skipping the detour jump. Code is
+ * decoded (see `decode_insn`) from `orig`, from start of every function of .symtab
+ * up to its size or first unknown instruction, so only real instructions are
+ * patched. Sites in bytes detour jumps overwrite, or with replacement out of
+ * reach, are left to the detour. Returns number of rewritten sites.
+ **/
+size_t rewrite_call_sites(ElfImage& exec, const ElfImage& orig, const SymbolIndex& exec_syms,
+                          const std::vector<rel_input>& rels, const rel_globals& globals,
+                          const std::vector<detour_spec>& detours, const std::vector<detour_site>& sites);
+
+/**
+ * Does the whole job, result is written to `job.out_fname`.
+ * `exec` must be opened from `job.exec_fname`.
+ * If `stats` is given, its counters are collected and its phases get times of:
+ * read, gc, icf, merge (collecting moved sections too), layout (with their
+ * bytes copied), append_sections, add_moved_section_names, phdrs,
+ * resolve_relocations, overwrite_start, detours (with call sites rewritten),
+ * dump - or only `cache` when output is taken from `options.cache_dir`.
+ * Throws std::string on error.
+ **/
+void link(const ExecInput& exec, const LinkJob& job, LinkStats* stats = nullptr);
+
+/**
+ * Report of `stats` of `job`: `[STATS]` lines, or single line JSON object.
+ **/
+std::string stats_report(const LinkJob& job, const LinkStats& stats, StatsFormat format);
@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "Merge.hpp"
+
+size_t merge_map::vaddr(size_t off, size_t base) const {
+    // last entry starting at or before `off`
+    auto it = std::upper_bound(entries.begin(), entries.end(), off, [](size_t o, const merge_entry& e) {
+        return o < e.in_off;
+    });
+    assert(it != entries.begin());
+    --it;
+    return (it->in_exec ? it->out : base + it->out) + (off - it->in_off);
+}
+
+// entries of string section end with `entsize` zero bytes at `entsize` aligned offset
+static size_t string_end(std::string_view content, size_t off, size_t entsize) {
+    for (; off + entsize <= content.size(); off += entsize) {
+        if (content.substr(off, entsize).find_first_not_of('\0') == std::string_view::npos)
+            return off + entsize;
+    }
+    return std::string_view::npos;
+}
+
+size_t RodataIndex::find(std::string_view entry, bool string) {
+    if (string) {
+        if (!indexed_strings) {
+            indexed_strings = true;
+            for (size_t off = 0; off < content.size(); ) {
+                size_t end = content.find('\0', off);
+                if (end == std::string_view::npos)
+                    break;
+                strings.emplace(content.substr(off, end + 1 - off), vaddr + off);
+                off = end + 1;
+            }
+        }
+        auto it = strings.find(entry);
+        return it == strings.end() ? std::string::npos : it->second;
+    }
+
+    auto [idx, fresh] = consts.try_emplace(entry.size());
+    if (fresh) {
+        // .rodata vaddr is aligned at least as its content
+        for (size_t off = 0; off + entry.size() <= content.size(); off += entry.size())
+            idx->second.emplace(content.substr(off, entry.size()), vaddr + off);
+    }
+    auto it = idx->second.find(entry);
+    return it == idx->second.end() ? std::string::npos : it->second;
+}
+
+bool mergeable(const Elf64_Shdr& hdr, std::string_view content) {
+    size_t entsize = hdr.sh_entsize;
+    if (!(hdr.sh_flags & SHF_MERGE) || entsize == 0 || content.size() % entsize != 0
+        || hdr.sh_type != SHT_PROGBITS)
+        return false;
+    if (!(hdr.sh_flags & SHF_STRINGS))
+        return true;
+    // every string must be terminated
+    for (size_t off = 0; off < content.size(); ) {
+        off = string_end(content, off, entsize);
+        if (off == std::string_view::npos)
+            return false;
+    }
+    return true;
+}
+
+std::pair<std::string_view, size_t> merge_entry_at(const Elf64_Shdr& hdr, std::string_view content, size_t off) {
+    size_t entsize = hdr.sh_entsize;
+    if (off >= content.size())
+        return std::make_pair(std::string_view(), off);
+    size_t start = off / entsize * entsize;
+    if (!(hdr.sh_flags & SHF_STRINGS))
+        return std::make_pair(content.substr(start, entsize), start);
+    // string begins after terminator of previous one
+    while (start >= entsize
+           && content.substr(start - entsize, entsize).find_first_not_of('\0') != std::string_view::npos)
+        start -= entsize;
+    return std::make_pair(content.substr(start, string_end(content, start, entsize) - start), start);
+}
+
+merged_section merge_sections(const std::vector<merge_input>& inputs, RodataIndex* exec) {
+    assert(!inputs.empty());
+    const Elf64_Shdr& first = *inputs.front().hdr;
+    const size_t entsize = first.sh_entsize;
+    const bool strings = first.sh_flags & SHF_STRINGS;
+    const size_t align = std::max<size_t>(first.sh_addralign, 1);
+
+    merged_section res;
+    res.hdr = first;
+    res.maps.resize(inputs.size());
+
+    // unique entries in order of first appearance, out offset known at the end
+    std::unordered_map<std::string_view, size_t> unique;
+    std::vector<std::string_view> entries;
+    std::vector<size_t> out;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        std::string_view content = inputs[i].content;
+        for (size_t off = 0; off < content.size(); ) {
+            size_t end = strings ? string_end(content, off, entsize) : off + entsize;
+            std::string_view entry = content.substr(off, end - off);
+            auto [it, fresh] = unique.emplace(entry, entries.size());
+            if (fresh) {
+                entries.push_back(entry);
+                out.push_back(std::string::npos);
+            }
+            res.maps[i].entries.push_back(merge_entry{off, it->second, false});
+            off = end;
+        }
+    }
+
+    // entries ET_EXEC already has
+    std::vector<bool> in_exec(entries.size(), false);
+    if (exec != nullptr && (!strings || entsize == 1)) {
+        for (size_t e = 0; e < entries.size(); e++) {
+            size_t vaddr = exec->find(entries[e], strings);
+            if (vaddr != std::string::npos && vaddr % align == 0) {
+                out[e] = vaddr;
+                in_exec[e] = true;
+            }
+        }
+    }
+
+    // string that is tail of another is stored inside it: with reversed strings sorted
+    // in descending order, every one directly follows a string it could be tail of
+    std::vector<size_t> tail_of(entries.size(), std::string::npos);
+    if (strings && entsize == 1) {
+        std::vector<size_t> order;
+        for (size_t e = 0; e < entries.size(); e++) {
+            if (!in_exec[e])
+                order.push_back(e);
+        }
+        auto rev_greater = [&](size_t a, size_t b) {
+            return std::lexicographical_compare(entries[b].rbegin(), entries[b].rend(),
+                                                entries[a].rbegin(), entries[a].rend());
+        };
+        std::sort(order.begin(), order.end(), rev_greater);
+        size_t kept = std::string::npos;
+        for (size_t e : order) {
+            std::string_view s = entries[e];
+            if (kept != std::string::npos && entries[kept].size() >= s.size()
+                && entries[kept].substr(entries[kept].size() - s.size()) == s)
+                tail_of[e] = kept;
+            else
+                kept = e;
+        }
+    }
+
+    for (size_t e = 0; e < entries.size(); e++) {
+        if (in_exec[e] || tail_of[e] != std::string::npos)
+            continue;
+        // constants keep alignment of their size, strings are packed
+        size_t a = strings ? entsize : std::max(align, entsize);
+        res.content.resize((res.content.size() + a - 1) / a * a, '\0');
+        out[e] = res.content.size();
+        res.content.append(entries[e]);
+    }
+    for (size_t e = 0; e < entries.size(); e++) {
+        if (tail_of[e] != std::string::npos)
+            out[e] = out[tail_of[e]] + entries[tail_of[e]].size() - entries[e].size();
+    }
+
+    for (merge_map& map : res.maps) {
+        for (merge_entry& entry : map.entries) {
+            entry.in_exec = in_exec[entry.out];
+            entry.out = out[entry.out];
+        }
+    }
+    res.hdr.sh_size = res.content.size();
+    return res;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <elf.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "ElfImage.hpp"
+
+/**
+ * Entry of merged input section: its bytes from `in_off` are at offset `out`
+ * of merged section - or at vaddr `out` of ET_EXEC, if `in_exec`.
+ **/
+struct merge_entry {
+    size_t in_off;
+    size_t out;
+    bool in_exec;
+};
+
+/**
+ * Where entries of one SHF_MERGE input section went, sorted by `in_off`.
+ **/
+struct merge_map {
+    std::vector<merge_entry> entries;
+
+    /**
+     * Address of byte `off` of input section, `base` - vaddr of merged section.
+     * Offsets inside an entry keep their distance from its start.
+     **/
+    size_t vaddr(size_t off, size_t base) const;
+};
+
+/**
+ * Equal entries of ET_EXEC's .rodata, for `merge_sections` to point at instead
+ * of storing them again: NUL-terminated strings (1 byte characters) and
+ * constants at offsets aligned to their size. Built on first use.
+ **/
+class RodataIndex {
+private:
+    std::string_view content;
+    size_t vaddr = 0;
+    bool indexed_strings = false;
+    std::unordered_map<std::string_view, size_t> strings; // with NUL
+    std::unordered_map<size_t, std::unordered_map<std::string_view, size_t>> consts; // by size
+
+public:
+    /**
+     * `content` of .rodata mapped at `vaddr`, it must outlive index.
+     **/
+    RodataIndex(std::string_view content, size_t vaddr) : content(content), vaddr(vaddr) {}
+
+    /**
+     * Vaddr of bytes equal to `entry` (string with its NUL, if `string`),
+     * std::string::npos if there are none.
+     **/
+    size_t find(std::string_view entry, bool string);
+};
+
+/**
+ * One SHF_MERGE section of ET_REL given to `merge_sections`.
+ **/
+struct merge_input {
+    const Elf64_Shdr* hdr;
+    std::string_view content;
+};
+
+/**
+ * Merged section: header (flags, entry size and alignment of inputs, sh_size)
+ * and content, plus map of every input.
+ **/
+struct merged_section {
+    Elf64_Shdr hdr;
+    std::string content;
+    std::vector<merge_map> maps; // same order as inputs
+};
+
+/**
+ * Whether `hdr` is SHF_MERGE section which `merge_sections` can split into
+ * entries: whole entries, strings ended with NUL.
+ **/
+bool mergeable(const Elf64_Shdr& hdr, std::string_view content);
+
+/**
+ * Entry of `mergeable` section containing byte `off` of it, and offset where the
+ * entry begins. Empty if `off` is out of the section.
+ **/
+std::pair<std::string_view, size_t> merge_entry_at(const Elf64_Shdr& hdr, std::string_view content, size_t off);
+
+/**
+ * Merges `inputs` of the same kind (flags, sh_entsize, sh_addralign) into one
+ * section. Equal entries are stored once; strings that are tail of a longer one
+ * point into it. With `exec`, entries it has are not stored at all.
+ **/
+merged_section merge_sections(const std::vector<merge_input>& inputs, RodataIndex* exec);
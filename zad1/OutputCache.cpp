@@ -0,0 +1,49 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <vector>
+
+#include "OutputCache.hpp"
+
+std::string CacheKey::hex() const {
+    char buf[33];
+    snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long) hi, (unsigned long long) lo);
+    return buf;
+}
+
+void hash_file(const ElfView& file, CacheHasher& h) {
+    static const size_t CHUNK = 1 << 20;
+    std::vector<char> buf(CHUNK);
+    const int fd = file.fd();
+    const size_t end = file.size();
+    h.add((uint64_t) end);
+    size_t pos = 0;
+    while (pos < end) {
+        off_t data = lseek(fd, pos, SEEK_DATA);
+        if (data < 0 && errno == ENXIO)
+            break;
+        off_t hole = data < 0 ? -1 : lseek(fd, data, SEEK_HOLE);
+        if (data < 0 || hole < 0) {
+            // no SEEK_DATA support - all of it is data
+            data = pos;
+            hole = end;
+        }
+        // same content with other extents only misses the cache
+        h.add((uint64_t) data);
+        size_t stop = std::min<size_t>(hole, end);
+        for (pos = data; pos < stop; ) {
+            ssize_t r = pread(fd, buf.data(), std::min(CHUNK, stop - pos), pos);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                throw "ERROR: Cannot read input: " + std::string(r < 0 ? strerror(errno) : "unexpected end of file");
+            h.add(buf.data(), r);
+            pos += r;
+        }
+    }
+}
+
+std::string cache_entry(const std::string& dir, const CacheKey& key) {
+    return dir + "/" + key.hex();
+}
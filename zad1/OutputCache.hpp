@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "ElfView.hpp"
+#include "RelocationPlan.hpp"
+
+/**
+ * Key of output cache entry - 128 bits, as a wrong hit silently gives wrong binary.
+ **/
+struct CacheKey {
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+
+    std::string hex() const;
+};
+
+/**
+ * Two PlanHashers with different offset bases, fed the same bytes.
+ **/
+class CacheHasher {
+private:
+    PlanHasher lo;
+    PlanHasher hi{0x6c62272e07bb0142ull};
+
+public:
+    void add(const void* data, size_t n) {
+        lo.add(data, n);
+        hi.add(data, n);
+    }
+
+    void add(std::string_view bytes) {
+        lo.add(bytes);
+        hi.add(bytes);
+    }
+
+    void add(uint64_t val) { add(&val, sizeof(val)); }
+
+    CacheKey value() const { return CacheKey{lo.value(), hi.value()}; }
+};
+
+/**
+ * Adds content of `file` to `h` without mapping it: data extents are read with
+ * pread through small buffer, holes are added as offset and length only - so
+ * hashing sparse file costs its data, not its size.
+ * Throws std::string on read error.
+ **/
+void hash_file(const ElfView& file, CacheHasher& h);
+
+/**
+ * Path of entry of `key` in cache directory `dir`.
+ **/
+std::string cache_entry(const std::string& dir, const CacheKey& key);
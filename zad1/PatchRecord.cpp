@@ -0,0 +1,106 @@
+#include <cstring>
+
+#include "PatchRecord.hpp"
+
+static const char MAGIC[8] = {'P', 'L', 'P', 'A', 'T', 'C', 'H', '1'};
+
+struct record_header {
+    char magic[8];
+    uint64_t orig_entry;
+    uint64_t orig_shnum;
+    Elf64_Shdr orig_shstrtab;
+    uint64_t patch_shnum;
+    uint64_t region_off;
+    uint64_t region_vaddr;
+    uint64_t region_size;
+    uint64_t num_slots;
+};
+
+struct slot_entry {
+    uint64_t flags;
+    uint64_t offset;
+    uint64_t size;
+};
+
+std::string patch_record::serialize() const {
+    record_header hdr;
+    memcpy(hdr.magic, MAGIC, sizeof(MAGIC));
+    hdr.orig_entry = orig_entry;
+    hdr.orig_shnum = orig_shnum;
+    hdr.orig_shstrtab = orig_shstrtab;
+    hdr.patch_shnum = patch_shnum;
+    hdr.region_off = region_off;
+    hdr.region_vaddr = region_vaddr;
+    hdr.region_size = region_size;
+    hdr.num_slots = slots.size();
+
+    std::string res((const char*) &hdr, sizeof(hdr));
+    for (const segment_slot& slot : slots) {
+        slot_entry e{slot.flags, slot.offset, slot.size};
+        res.append((const char*) &e, sizeof(e));
+    }
+    return res;
+}
+
+bool patch_record::parse(std::string_view bytes) {
+    record_header hdr;
+    if (bytes.size() < sizeof(hdr))
+        return false;
+    memcpy(&hdr, bytes.data(), sizeof(hdr));
+    if (memcmp(hdr.magic, MAGIC, sizeof(MAGIC)) != 0
+        || hdr.num_slots > MAX_SEGMENTS
+        || bytes.size() != sizeof(hdr) + hdr.num_slots * sizeof(slot_entry))
+        return false;
+
+    orig_entry = hdr.orig_entry;
+    orig_shnum = hdr.orig_shnum;
+    orig_shstrtab = hdr.orig_shstrtab;
+    patch_shnum = hdr.patch_shnum;
+    region_off = hdr.region_off;
+    region_vaddr = hdr.region_vaddr;
+    region_size = hdr.region_size;
+    slots.clear();
+    for (size_t i = 0; i < hdr.num_slots; i++) {
+        slot_entry e;
+        memcpy(&e, bytes.data() + sizeof(hdr) + i * sizeof(e), sizeof(e));
+        slots.push_back(segment_slot{(Elf64_Word) e.flags, e.offset, e.size});
+    }
+    return true;
+}
+
+bool read_patch_record(const ElfImage& exec, patch_record& rec) {
+    if (!exec.has_section(PATCH_RECORD_SECTION))
+        return false;
+    if (!rec.parse(exec.copy(exec.section(PATCH_RECORD_SECTION).sh_offset,
+                             exec.section(PATCH_RECORD_SECTION).sh_size)))
+        return false;
+
+    // everything that survives cutting the file must lie before the region
+    const Elf64_Ehdr& ehdr = exec.header();
+    return exec.shdrs().size() == rec.patch_shnum
+        && rec.orig_shnum < rec.patch_shnum
+        && ehdr.e_shstrndx < rec.orig_shnum
+        && ehdr.e_phoff + ehdr.e_phnum * ehdr.e_phentsize <= rec.region_off
+        && rec.orig_shstrtab.sh_offset + rec.orig_shstrtab.sh_size <= rec.region_off
+        && rec.region_off <= exec.size();
+}
+
+void strip_patch(ElfImage& exec, const patch_record& rec) {
+    const std::vector<Elf64_Phdr>& phdrs = exec.phs();
+    for (size_t i = 0; i < phdrs.size(); i++) {
+        const Elf64_Phdr& ph = phdrs[i];
+        if (ph.p_type == PT_LOAD && ph.p_vaddr >= rec.region_vaddr
+            && ph.p_vaddr < rec.region_vaddr + rec.region_size)
+            exec.set_phdr(i, Elf64_Phdr{});
+    }
+
+    std::vector<Elf64_Shdr> tbl;
+    for (size_t i = 0; i < rec.orig_shnum; i++)
+        tbl.push_back(exec.shdrs()[i].first);
+    tbl[exec.header().e_shstrndx] = rec.orig_shstrtab;
+    exec.reset_shdrs(rec.region_off, tbl);
+
+    Elf64_Ehdr ehdr = exec.header();
+    ehdr.e_entry = rec.orig_entry;
+    exec.set_header(ehdr);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <elf.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ElfImage.hpp"
+#include "Layout.hpp"
+
+/**
+ * Section in which re-patch mode (`--repatch`) records what it injected.
+ **/
+const char* const PATCH_RECORD_SECTION = ".postlinker";
+
+/**
+ * Segments of layout at most (R, RX, RW, RWX) - program header table gets
+ * that many free entries on first patch, so later ones never move it.
+ **/
+const size_t MAX_SEGMENTS = 4;
+
+/**
+ * What one patch injected, so that the next one can take it back.
+ * Everything from `region_off` to the end of file was written by the patch:
+ * layout (`region_size` bytes, mapped at `region_vaddr`), this record,
+ * section header table and .shstrtab copy. Bytes before it are ET_EXEC's
+ * (with program header table moved behind them by the first patch).
+ *
+ * On disk: magic, fixed fields, number of slots, slots.
+ **/
+struct patch_record {
+    Elf64_Addr orig_entry = 0;
+    size_t orig_shnum = 0; // sections of ET_EXEC itself, injected ones follow
+    Elf64_Shdr orig_shstrtab{}; // ET_EXEC's .shstrtab, left in place
+    size_t patch_shnum = 0; // sections right after the patch - otherwise file changed since
+    size_t region_off = 0;
+    Elf64_Addr region_vaddr = 0;
+    size_t region_size = 0;
+    std::vector<segment_slot> slots; // offsets relative to region start
+
+    std::string serialize() const;
+
+    /**
+     * Returns false if `bytes` are not a record.
+     **/
+    bool parse(std::string_view bytes);
+};
+
+/**
+ * Record of the patch that produced `exec`. Returns false if there is none,
+ * or `exec` was changed by other means since.
+ **/
+bool read_patch_record(const ElfImage& exec, patch_record& rec);
+
+/**
+ * Takes patch of `rec` back: file is cut at region start, injected sections are
+ * dropped, their PT_LOADs become PT_NULL (free for next patch), e_entry is restored.
+ * Section header table is left at the very end of file.
+ **/
+void strip_patch(ElfImage& exec, const patch_record& rec);
@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "PieceTable.hpp"
+#include "Stats.hpp"
+
+PieceTable::PieceTable(std::string_view external) {
+    if (!external.empty())
+        pieces.push_back(Piece{0, external.size(), external.data(), nullptr, 0, false});
+}
+
+PieceTable::PieceTable(std::string owned) {
+    append(std::move(owned));
+}
+
+PieceTable::PieceTable(const PieceTable& other) : pieces(other.pieces) {
+    for (Piece& p : pieces) {
+        if (p.buf) {
+            p.buf = std::make_shared<std::string>(p.data(), p.len);
+            p.buf_off = 0;
+            count_copied(p.len);
+        }
+    }
+}
+
+PieceTable& PieceTable::operator=(const PieceTable& other) {
+    if (this != &other)
+        *this = PieceTable(other);
+    return *this;
+}
+
+void PieceTable::check_range(size_t off, size_t n) const {
+    if (off > size() || size() - off < n)
+        throw std::string("Internal error: range out of file bounds");
+}
+
+size_t PieceTable::find(size_t off) const {
+    assert(off < size());
+    auto it = std::upper_bound(pieces.begin(), pieces.end(), off, [](size_t o, const Piece& p) {
+        return o < p.off;
+    });
+    return it - pieces.begin() - 1;
+}
+
+size_t PieceTable::split(size_t off) {
+    if (off == size())
+        return pieces.size();
+    size_t i = find(off);
+    if (pieces[i].off == off)
+        return i;
+
+    Piece tail = pieces[i];
+    size_t d = off - tail.off;
+    tail.off = off;
+    tail.len -= d;
+    if (tail.ext)
+        tail.ext += d;
+    tail.buf_off += d;
+
+    pieces[i].len = d;
+    pieces[i].growable = false; // it doesn't end its buffer anymore
+    pieces.insert(pieces.begin() + i + 1, std::move(tail));
+    return i + 1;
+}
+
+void PieceTable::replace(size_t off, size_t n, Piece piece) {
+    assert(n > 0 && piece.len == n);
+    size_t b = split(off);
+    size_t e = split(off + n);
+    piece.off = off;
+    pieces.erase(pieces.begin() + b, pieces.begin() + e);
+    pieces.insert(pieces.begin() + b, std::move(piece));
+}
+
+std::string_view PieceTable::read(size_t off, size_t n) const {
+    check_range(off, n);
+    if (n == 0)
+        return std::string_view();
+    const Piece& p = pieces[find(off)];
+    if (p.is_hole() || off + n > p.end())
+        throw std::string("Internal error: range is not stored contiguously");
+    return std::string_view(p.data() + (off - p.off), n);
+}
+
+std::string PieceTable::copy(size_t off, size_t n) const {
+    check_range(off, n);
+    std::string res(n, '\0');
+    if (n == 0)
+        return res;
+    count_copied(n);
+    for (size_t i = find(off); i < pieces.size() && pieces[i].off < off + n; i++) {
+        const Piece& p = pieces[i];
+        size_t b = std::max(off, p.off);
+        size_t e = std::min(off + n, p.end());
+        if (!p.is_hole())
+            std::memcpy(&res[b - off], p.data() + (b - p.off), e - b);
+    }
+    return res;
+}
+
+void PieceTable::write(size_t off, const void* src, size_t n) {
+    check_range(off, n);
+    if (n == 0)
+        return;
+    count_copied(n);
+    Piece& p = pieces[find(off)];
+    if (p.buf && off + n <= p.end()) {
+        std::memcpy(&(*p.buf)[p.buf_off + (off - p.off)], src, n);
+        return;
+    }
+    // whole range is overwritten, so nothing has to be copied
+    replace(off, n, Piece{off, n, nullptr, std::make_shared<std::string>((const char*) src, n), 0, false});
+}
+
+void PieceTable::zero(size_t off, size_t n) {
+    check_range(off, n);
+    if (n > 0)
+        replace(off, n, Piece{off, n, nullptr, nullptr, 0, false});
+}
+
+void PieceTable::append(std::string_view bytes) {
+    if (bytes.empty())
+        return;
+    count_copied(bytes.size());
+    if (!pieces.empty() && pieces.back().growable) {
+        Piece& p = pieces.back();
+        p.buf->append(bytes.data(), bytes.size());
+        p.len += bytes.size();
+        return;
+    }
+    pieces.push_back(Piece{size(), bytes.size(), nullptr, std::make_shared<std::string>(bytes), 0, true});
+}
+
+void PieceTable::append(std::string&& bytes) {
+    if (bytes.empty())
+        return;
+    size_t n = bytes.size();
+    pieces.push_back(Piece{size(), n, nullptr, std::make_shared<std::string>(std::move(bytes)), 0, false});
+}
+
+void PieceTable::append_zeros(size_t n) {
+    if (n == 0)
+        return;
+    if (!pieces.empty() && pieces.back().is_hole()) {
+        pieces.back().len += n;
+        return;
+    }
+    pieces.push_back(Piece{size(), n, nullptr, nullptr, 0, false});
+}
+
+void PieceTable::truncate(size_t n) {
+    check_range(n, 0);
+    size_t i = split(n); // may reallocate
+    pieces.erase(pieces.begin() + i, pieces.end());
+}
+
+void PieceTable::prepend(std::string bytes, size_t n) {
+    assert(bytes.size() <= n);
+    for (Piece& p : pieces)
+        p.off += n;
+
+    std::vector<Piece> head;
+    size_t len = bytes.size();
+    if (len > 0)
+        head.push_back(Piece{0, len, nullptr, std::make_shared<std::string>(std::move(bytes)), 0, false});
+    if (n > len)
+        head.push_back(Piece{len, n - len, nullptr, nullptr, 0, false});
+    pieces.insert(pieces.begin(), std::make_move_iterator(head.begin()), std::make_move_iterator(head.end()));
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * File content kept as list of pieces instead of one contiguous buffer.
+ * Piece is either read-only view of external memory (e.g. input file mapped
+ * by ElfView), bytes owned by the table, or hole (zeros that are not stored
+ * at all). Output file is written piece by piece (see write_file), so
+ * unchanged input bytes are never copied in memory.
+ *
+ * Writes to external bytes or holes copy only the written range (copy on write).
+ * Views returned by `read` are valid until next modification of the table.
+ **/
+class PieceTable {
+public:
+    struct Piece {
+        size_t off = 0;                     // in file
+        size_t len = 0;
+        const char* ext = nullptr;          // external bytes
+        std::shared_ptr<std::string> buf;   // owned bytes, starting at `buf_off`
+        size_t buf_off = 0;
+        bool growable = false;              // `append` may extend `buf` in place
+
+        bool is_hole() const { return ext == nullptr && !buf; }
+
+        const char* data() const { return buf ? buf->data() + buf_off : ext; }
+
+        size_t end() const { return off + len; }
+    };
+
+private:
+    std::vector<Piece> pieces; // sorted by offset, adjacent, non-empty
+
+    // index of piece containing `off` (off < size())
+    size_t find(size_t off) const;
+
+    // makes `off` a piece boundary, returns index of piece starting there
+    size_t split(size_t off);
+
+    // replaces pieces in [off, off + n) with `piece`
+    void replace(size_t off, size_t n, Piece piece);
+
+    void check_range(size_t off, size_t n) const;
+
+public:
+    PieceTable() = default;
+
+    explicit PieceTable(std::string_view external);
+
+    explicit PieceTable(std::string owned);
+
+    /**
+     * Copy owns its own bytes (external ones are still shared).
+     **/
+    PieceTable(const PieceTable& other);
+    PieceTable& operator=(const PieceTable& other);
+    PieceTable(PieceTable&&) = default;
+    PieceTable& operator=(PieceTable&&) = default;
+
+    size_t size() const { return pieces.empty() ? 0 : pieces.back().end(); }
+
+    const std::vector<Piece>& all() const { return pieces; }
+
+    /**
+     * View of [off, off + n). Range must lie inside one stored piece,
+     * otherwise std::string is thrown - use `copy` for arbitrary ranges.
+     **/
+    std::string_view read(size_t off, size_t n) const;
+
+    std::string copy(size_t off, size_t n) const;
+
+    void write(size_t off, const void* src, size_t n);
+
+    /**
+     * Turns [off, off + n) into hole.
+     **/
+    void zero(size_t off, size_t n);
+
+    void append(std::string_view bytes);
+
+    /**
+     * Appends `bytes` as separate piece, without copying them.
+     **/
+    void append(std::string&& bytes);
+
+    void append_zeros(size_t n);
+
+    void truncate(size_t n);
+
+    /**
+     * Inserts `bytes` followed by zeros up to `n` bytes at the very beginning.
+     **/
+    void prepend(std::string bytes, size_t n);
+};
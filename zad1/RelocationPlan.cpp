@@ -0,0 +1,129 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "RelocationPlan.hpp"
+
+static const char MAGIC[8] = {'P', 'L', 'P', 'L', 'A', 'N', '1', '\0'};
+
+struct plan_header {
+    char magic[8];
+    uint64_t key;
+    uint64_t start_idx;
+    uint64_t count;
+    uint64_t names_size;
+};
+
+// FNV-1a step per 64-bit word, so that hashing big .rela sections stays cheap;
+// multiplication carries only upwards, so high bits are folded back
+void PlanHasher::add(const void* data, size_t n) {
+    const unsigned char* p = (const unsigned char*) data;
+    for (; n >= sizeof(uint64_t); n -= sizeof(uint64_t), p += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        h ^= word;
+        h *= 1099511628211ull;
+        h ^= h >> 32;
+    }
+    for (; n > 0; n--, p++) {
+        h ^= *p;
+        h *= 1099511628211ull;
+    }
+}
+
+void RelocationPlan::add(const rela_descr& r) {
+    auto it = name_offs.find(r.symbol.second);
+    if (it == name_offs.end()) {
+        it = name_offs.emplace(r.symbol.second, names.size()).first;
+        names += r.symbol.second;
+        names.push_back('\0');
+    }
+    relas.push_back(planned_rela{
+        r.vaddr, r.symbol.first.st_value, r.hdr.r_addend, r.got_vaddr,
+        (uint32_t) ELF64_R_TYPE(r.hdr.r_info), it->second,
+    });
+}
+
+rela_descr RelocationPlan::descr(const planned_rela& p) const {
+    rela_descr res{};
+    res.hdr.r_info = ELF64_R_INFO(0, p.type);
+    res.hdr.r_addend = p.addend;
+    res.symbol.first.st_value = p.value;
+    res.symbol.second = names.c_str() + p.name;
+    res.vaddr = p.vaddr;
+    res.got_vaddr = p.got_vaddr;
+    return res;
+}
+
+void RelocationPlan::save(const std::string& path) const {
+    plan_header hdr;
+    memcpy(hdr.magic, MAGIC, sizeof(MAGIC));
+    hdr.key = key;
+    hdr.start_idx = start_idx;
+    hdr.count = relas.size();
+    hdr.names_size = names.size();
+
+    std::string tmp = path + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (f == nullptr)
+        throw "ERROR: Cannot write relocation plan " + path + ": " + strerror(errno);
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1
+        && fwrite(relas.data(), sizeof(planned_rela), relas.size(), f) == relas.size()
+        && fwrite(names.data(), 1, names.size(), f) == names.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        throw "ERROR: Cannot write relocation plan " + path;
+    }
+}
+
+bool RelocationPlan::load(const std::string& path, uint64_t key) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == nullptr) {
+        if (errno == ENOENT)
+            return false;
+        throw "ERROR: Cannot read relocation plan " + path + ": " + strerror(errno);
+    }
+    plan_header hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        fclose(f);
+        throw "ERROR: " + path + " is not a relocation plan";
+    }
+    if (hdr.key != key) {
+        fclose(f);
+        return false;
+    }
+
+    // sizes must fit in the file before anything is allocated for them
+    struct stat st;
+    if (fstat(fileno(f), &st) != 0) {
+        fclose(f);
+        throw "ERROR: Cannot read relocation plan " + path + ": " + strerror(errno);
+    }
+    uint64_t rest = (uint64_t) st.st_size - sizeof(hdr);
+    if (hdr.count > rest / sizeof(planned_rela) || hdr.names_size != rest - hdr.count * sizeof(planned_rela)) {
+        fclose(f);
+        throw "ERROR: Malformed relocation plan " + path;
+    }
+
+    std::vector<planned_rela> entries(hdr.count);
+    std::string strs(hdr.names_size, '\0');
+    bool ok = fread(entries.data(), sizeof(planned_rela), entries.size(), f) == entries.size()
+        && fread(&strs[0], 1, strs.size(), f) == strs.size();
+    fclose(f);
+    if (!ok || (!strs.empty() && strs.back() != '\0'))
+        throw "ERROR: Malformed relocation plan " + path;
+    for (const planned_rela& p : entries) {
+        if (p.name >= strs.size())
+            throw "ERROR: Malformed relocation plan " + path;
+    }
+
+    this->key = key;
+    start_idx = hdr.start_idx;
+    relas = std::move(entries);
+    names = std::move(strs);
+    name_offs.clear();
+    return true;
+}
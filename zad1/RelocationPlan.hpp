@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Relocator.hpp"
+
+/**
+ * 64-bit FNV-1a (over words) of everything `add`ed, in order.
+ **/
+class PlanHasher {
+private:
+    uint64_t h = 14695981039346656037ull;
+
+public:
+    PlanHasher() = default;
+
+    // other offset basis gives independent hash of the same bytes
+    explicit PlanHasher(uint64_t basis) : h(basis) {}
+
+    void add(const void* data, size_t n);
+
+    void add(std::string_view bytes) {
+        add(bytes.size());
+        add(bytes.data(), bytes.size());
+    }
+
+    void add(uint64_t val) { add(&val, sizeof(val)); }
+
+    uint64_t value() const { return h; }
+};
+
+/**
+ * One relocation with its symbol already resolved.
+ **/
+struct planned_rela {
+    uint64_t vaddr; // of relocated field
+    uint64_t value; // of symbol
+    int64_t addend;
+    uint64_t got_vaddr; // 0 if not going through GOT
+    uint32_t type;
+    uint32_t name; // offset of symbol's name in `names`
+};
+
+/**
+ * Result of symbol resolution of whole job: everything Relocator needs,
+ * so relocations can be replayed without any lookup.
+ * It's valid only for inputs with the same `key` (see `plan_key` in Linker).
+ *
+ * On disk: magic, key, `_start` index, number of relocations, size of names,
+ * planned_rela entries, names (each ended with NUL).
+ **/
+struct RelocationPlan {
+    uint64_t key = 0;
+    size_t start_idx = SymbolIndex::npos; // of `_start` in ET_EXEC's .symtab
+    std::vector<planned_rela> relas;
+    std::string names;
+
+    /**
+     * Appends relocation resolved to `r`.
+     **/
+    void add(const rela_descr& r);
+
+    /**
+     * Relocation as given to Relocator.
+     **/
+    rela_descr descr(const planned_rela& p) const;
+
+    /**
+     * Atomically replaces `path`. Throws std::string on failure.
+     **/
+    void save(const std::string& path) const;
+
+    /**
+     * Returns false if `path` doesn't exist or its key is not `key`.
+     * Throws std::string if it's not readable or malformed.
+     **/
+    bool load(const std::string& path, uint64_t key);
+
+private:
+    std::unordered_map<std::string, uint32_t> name_offs; // while adding
+};
@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <sstream>
+
+#include "Relocator.hpp"
+#include "Stats.hpp"
+
+Relocator::Relocator(ElfImage& exec) : exec(exec) {
+    for (const auto& ph : exec.phs()) {
+        if (ph.p_type == PT_LOAD) {
+            loads.push_back(ph);
+            segments.push_back(Segment{ph.p_vaddr, ph.p_memsz, ph.p_offset});
+        }
+    }
+    std::sort(segments.begin(), segments.end(), [](const Segment& a, const Segment& b) {
+        return a.vaddr < b.vaddr;
+    });
+}
+
+size_t Relocator::vaddr2off(size_t vaddr) const {
+    // relocations mostly come in order of their sections, so last segment usually hits
+    if (last_hit < segments.size()) {
+        const Segment& s = segments[last_hit];
+        if (vaddr >= s.vaddr && vaddr <= s.vaddr + s.memsz)
+            return s.offset + (vaddr - s.vaddr);
+    }
+
+    auto it = std::upper_bound(segments.begin(), segments.end(), vaddr, [](size_t v, const Segment& s) {
+        return v < s.vaddr;
+    });
+    if (it != segments.begin()) {
+        --it;
+        if (vaddr <= it->vaddr + it->memsz) {
+            last_hit = it - segments.begin();
+            return it->offset + (vaddr - it->vaddr);
+        }
+    }
+
+    // overlapping segments - first one in program header table order wins
+    for (const auto& ph : loads) {
+        if (vaddr >= ph.p_vaddr && vaddr <= ph.p_vaddr + ph.p_memsz)
+            return ph.p_offset + (vaddr - ph.p_vaddr);
+    }
+    std::stringstream err;
+    err << "Internal error: Adress " << std::hex << vaddr << " isn't mapped into memory";
+    throw err.str();
+}
+
+void Relocator::write(size_t off, const void* src, size_t n) {
+    if (log == nullptr) {
+        exec.write(off, src, n);
+        return;
+    }
+    assert(n <= sizeof(Store::bytes));
+    Store st{off, n, {}};
+    memcpy(st.bytes, src, n);
+    log->push_back(st);
+}
+
+void Relocator::commit(ElfImage& exec, const std::vector<Store>& log) {
+    for (const Store& st : log)
+        exec.write(st.off, st.bytes, st.len);
+}
+
+static void check_overflow(bool fits, const rela_descr& r, int64_t val) {
+    if (fits)
+        return;
+    std::stringstream err;
+    err << "Linking error: relocation of type " << ELF64_R_TYPE(r.hdr.r_info) << " against symbol "
+        << r.symbol.second << " at 0x" << std::hex << r.vaddr << " overflows (value 0x" << val << ")";
+    throw err.str();
+}
+
+static bool fits_signed32(int64_t val) {
+    return val >= INT32_MIN && val <= INT32_MAX;
+}
+
+static bool fits_unsigned32(int64_t val) {
+    return val >= 0 && val <= UINT32_MAX;
+}
+
+bool is_gotpcrel(unsigned type) {
+    return type == R_X86_64_GOTPCREL || type == R_X86_64_GOTPCRELX || type == R_X86_64_REX_GOTPCRELX;
+}
+
+// second byte is ModRM, only %rip relative operand is expected
+static const unsigned char MOV_LOAD = 0x8b, LEA = 0x8d, INDIRECT = 0xff, CALL_MODRM = 0x15, JMP_MODRM = 0x25;
+static const unsigned char CALL_REL32 = 0xe8, JMP_REL32 = 0xe9, ADDR32 = 0x67, NOP = 0x90;
+
+bool gotpcrel_relaxable(unsigned type, std::string_view code) {
+    if (code.size() < 2 || (type != R_X86_64_GOTPCRELX && type != R_X86_64_REX_GOTPCRELX))
+        return false;
+    unsigned char op = code[code.size() - 2], modrm = code[code.size() - 1];
+    if (op == MOV_LOAD)
+        return (modrm & 0xc7) == 0x05;
+    // with REX prefix call/jmp couldn't be rewritten in place
+    return type == R_X86_64_GOTPCRELX && op == INDIRECT && (modrm == CALL_MODRM || modrm == JMP_MODRM);
+}
+
+void Relocator::relax_gotpcrel(const rela_descr& r, int64_t val) {
+    size_t off = vaddr2off(r.vaddr);
+    std::string insn = exec.copy(off - 2, 2);
+    int64_t pc = (int64_t) r.vaddr;
+    unsigned char op = insn[0], modrm = insn[1];
+
+    if (op == MOV_LOAD) {
+        write(off - 2, &LEA, 1);
+    } else if (op == INDIRECT && modrm == CALL_MODRM) {
+        const unsigned char call[] = {ADDR32, CALL_REL32};
+        write(off - 2, call, sizeof(call));
+    } else if (op == INDIRECT && modrm == JMP_MODRM) {
+        // one byte shorter, displacement moves back
+        write(off - 2, &JMP_REL32, 1);
+        write(off + 3, &NOP, 1);
+        off--;
+        pc--;
+    } else {
+        throw std::string("Internal error: GOTPCREL relocation at unexpected instruction");
+    }
+    val -= pc;
+    check_overflow(fits_signed32(val), r, val);
+    store<int32_t>(off, val);
+}
+
+bool Relocator::apply(const rela_descr& r) {
+    bool applied = apply_help(r);
+    count_relocation(ELF64_R_TYPE(r.hdr.r_info), applied);
+    return applied;
+}
+
+bool Relocator::apply_help(const rela_descr& r) {
+    int64_t val = (int64_t) r.symbol.first.st_value + r.hdr.r_addend;
+    int64_t pc = (int64_t) r.vaddr;
+
+    switch (ELF64_R_TYPE(r.hdr.r_info)) {
+    case R_X86_64_PC32:
+    case R_X86_64_PLT32: // there is no PLT, symbol is called directly
+        val -= pc;
+        check_overflow(fits_signed32(val), r, val);
+        store<int32_t>(vaddr2off(r.vaddr), val);
+        return true;
+    case R_X86_64_PC64:
+        store<int64_t>(vaddr2off(r.vaddr), val - pc);
+        return true;
+    case R_X86_64_32:
+        check_overflow(fits_unsigned32(val), r, val);
+        store<uint32_t>(vaddr2off(r.vaddr), val);
+        return true;
+    case R_X86_64_32S:
+        check_overflow(fits_signed32(val), r, val);
+        store<int32_t>(vaddr2off(r.vaddr), val);
+        return true;
+    case R_X86_64_64:
+        store<int64_t>(vaddr2off(r.vaddr), val);
+        return true;
+    case R_X86_64_GOTPCREL:
+    case R_X86_64_GOTPCRELX:
+    case R_X86_64_REX_GOTPCRELX:
+        if (r.got_vaddr == 0) {
+            // ET_EXEC has fixed addresses, so symbol can be addressed directly
+            relax_gotpcrel(r, val);
+            return true;
+        }
+        store<uint64_t>(vaddr2off(r.got_vaddr), r.symbol.first.st_value);
+        val = (int64_t) r.got_vaddr + r.hdr.r_addend - pc;
+        check_overflow(fits_signed32(val), r, val);
+        store<int32_t>(vaddr2off(r.vaddr), val);
+        return true;
+    default:
+        return false;
+    }
+}
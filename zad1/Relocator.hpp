@@ -0,0 +1,104 @@
+#pragma once
+
+#include <elf.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ElfImage.hpp"
+#include "SymbolIndex.hpp"
+
+typedef struct rela_descr {
+    Elf64_Rela hdr;
+    symbol_descr symbol;
+    size_t vaddr;
+    size_t got_vaddr = 0; // GOT slot of symbol, for GOT-relative relocation that can't be relaxed (or reach it)
+} rela_descr;
+
+/**
+ * R_X86_64_GOTPCREL, GOTPCRELX or REX_GOTPCRELX.
+ **/
+bool is_gotpcrel(unsigned type);
+
+/**
+ * Whether GOT-relative relocation of `type` can be relaxed to direct addressing,
+ * `code` being bytes of its section up to relocated field:
+ * `mov foo@GOTPCREL(%rip), %reg` -> `lea foo(%rip), %reg`,
+ * `call *foo@GOTPCREL(%rip)` -> `addr32 call foo`,
+ * `jmp *foo@GOTPCREL(%rip)` -> `jmp foo; nop`.
+ * As in psABI only GOTPCRELX (and REX_GOTPCRELX for mov) are relaxable.
+ **/
+bool gotpcrel_relaxable(unsigned type, std::string_view code);
+
+/**
+ * Applies relocations directly to ET_EXEC output buffer.
+ * PT_LOAD table is cached (sorted by vaddr) at construction, so image
+ * layout must not change while Relocator is alive - only bytes are written.
+ * Errors (unmapped address, store out of file, 32-bit overflow) are thrown
+ * as std::string.
+ **/
+class Relocator {
+public:
+    /**
+     * Bytes of one store, when recorded instead of written (see `record`).
+     **/
+    struct Store {
+        size_t off;
+        size_t len;
+        char bytes[sizeof(uint64_t)];
+    };
+
+private:
+    struct Segment {
+        size_t vaddr;
+        size_t memsz;
+        size_t offset;
+    };
+
+    ElfImage& exec;
+    std::vector<Segment> segments;
+    std::vector<Elf64_Phdr> loads; // PT_LOADs in program header table order
+    mutable size_t last_hit = 0;
+    std::vector<Store>* log = nullptr;
+
+    bool apply_help(const rela_descr& r);
+
+    void write(size_t off, const void* src, size_t n);
+
+    void relax_gotpcrel(const rela_descr& r, int64_t val);
+
+public:
+    explicit Relocator(ElfImage& exec);
+
+    /**
+     * Translates virtual address to file offset.
+     **/
+    size_t vaddr2off(size_t vaddr) const;
+
+    /**
+     * Bounds-checked store of `val` at `off` file offset.
+     **/
+    template<typename T>
+    void store(size_t off, T val) {
+        if (off > exec.size() || exec.size() - off < sizeof(T))
+            throw std::string("Internal error: relocation store out of file bounds");
+        write(off, &val, sizeof(T));
+    }
+
+    /**
+     * From now on stores are appended to `log` instead of being written - image
+     * is only read, so many Relocators may work on it concurrently.
+     * Recorded stores are written by `commit`.
+     **/
+    void record(std::vector<Store>* log) { this->log = log; }
+
+    static void commit(ElfImage& exec, const std::vector<Store>& log);
+
+    /**
+     * Computes relocation value and stores it.
+     * Returns false (and leaves file untouched) for unsupported relocation type.
+     **/
+    bool apply(const rela_descr& r);
+};
@@ -21,27 +21,17 @@
 
 typedef SectionEditor SE;
 
-std::string SE::get_section_content(const std::string& content, Elf64_Shdr section_hdr) {
-    Elf64_Ehdr h = get_elf_header(content);
+std::string SE::get_section_content(std::string_view content, Elf64_Shdr section_hdr) {
     int begin = section_hdr.sh_offset;
     // char _res[section_hdr.sh_size];
     // memcpy(_res, content.data(), section_hdr.sh_size);
     // std::string res(_res, section_hdr.sh_size); // = content.substr(begin, section_hdr.sh_size);
-    std::string res = content.substr(begin, section_hdr.sh_size);
+    std::string res(content.substr(begin, section_hdr.sh_size));
     assert(res.size() == section_hdr.sh_size);
     return res;
 }
 
-
-/**
- * Get address of exact section header offset.
- * Called with num=0 returns adress of section header table.
- **/
-inline size_t SE::get_sh_offset(Elf64_Ehdr hdr, size_t num) {
-    return hdr.e_shoff + (num * hdr.e_shentsize);
-}
-
-std::string SE::get_section_content(const std::string& content, const std::string& name) {
+std::string SE::get_section_content(std::string_view content, const std::string& name) {
     std::vector<section_descr> s_tbl = get_shdrs(content);
     Elf64_Shdr shdr = find_section(name, s_tbl);
     return get_section_content(content, shdr);
@@ -51,7 +41,7 @@ std::string SE::get_section_content(const std::string& content, const std::strin
 /**
  * Returns vector of all sections headers with it's names.
  **/
-std::vector<section_descr> SE::get_shdrs(const std::string& content) {
+std::vector<section_descr> SE::get_shdrs(std::string_view content) {
     Elf64_Ehdr h = get_elf_header(content);
     std::vector<Elf64_Shdr> s_hdrs;
     for (int i = 0; i < h.e_shnum; i++) {
@@ -77,9 +67,9 @@ std::vector<section_descr> SE::get_shdrs(const std::string& content) {
     return res;
 }
 
-bool sec_hdr_tbl_at_very_end(const std::string& content) {
-    Elf64_Ehdr ehdr = get_elf_header(content);
-    bool res = ehdr.e_shoff + ehdr.e_shnum * ehdr.e_shentsize == content.size();
+bool sec_hdr_tbl_at_very_end(const ElfImage& img) {
+    const Elf64_Ehdr& ehdr = img.header();
+    bool res = ehdr.e_shoff + ehdr.e_shnum * ehdr.e_shentsize == img.size();
     return res;
 }
 
@@ -99,9 +89,8 @@ size_t SE::find_section_idx(const std::string& name, const std::vector<section_d
 }
 
 
-size_t SE::get_section_idx(const std::string& content, const std::string& name) {
-    auto shdrs = SE::get_shdrs(content);
-    return SE::find_section_idx(name, shdrs);
+size_t SE::get_section_idx(const ElfImage& img, const std::string& name) {
+    return img.section_idx(name);
 }
 
 
@@ -113,96 +102,110 @@ Elf64_Shdr SE::find_section(const std::string& name, const std::vector<section_d
  * Used for finding ET_EXEC's mapped to virtual memory sections, thus
  * assert with nonzero return.
  */
-size_t SE::get_section_vaddr(const std::string& content, const std::string& name) {
-    auto shdrs = SE::get_shdrs(content);
-    auto shdr = SE::find_section(name, shdrs);
+size_t SE::get_section_vaddr(const ElfImage& img, const std::string& name) {
+    const Elf64_Shdr& shdr = img.section(name);
     assert(shdr.sh_addr != 0);
     return shdr.sh_addr;
 }
 
 
-void SectionEditor::append_sections(std::string& content, 
+size_t SectionEditor::append_sections(ElfImage& img, 
                                     std::vector<section_descr>& new_sections, 
-                                    const std::vector<std::string>& new_sections_contents) {
-    if (!sec_hdr_tbl_at_very_end(content)) {
-        Elf64_Ehdr ehdr = get_elf_header(content);
-        std::string sec_hdr_table = content.substr(ehdr.e_shoff, ehdr.e_shentsize * ehdr.e_shnum);
-        size_t pos0 = content.size(); 
-        content.append(sec_hdr_table);
+                                    std::vector<std::string> new_sections_contents,
+                                    const layout_plan& plan,
+                                    size_t base_vaddr,
+                                    size_t shift) {
+    if (!sec_hdr_tbl_at_very_end(img)) {
+        Elf64_Ehdr ehdr = img.header();
+        std::string sec_hdr_table = img.copy(ehdr.e_shoff, ehdr.e_shentsize * ehdr.e_shnum);
+        size_t pos0 = img.size(); 
+        img.append(std::move(sec_hdr_table));
         ehdr.e_shoff = pos0;
-        content.replace(0, sizeof(Elf64_Ehdr), (const char *) &ehdr, sizeof(Elf64_Ehdr));
+        img.set_header(ehdr);
     }
-    assert(sec_hdr_tbl_at_very_end(content));
-    SE::append_sections_help(content, new_sections, new_sections_contents);
+    assert(sec_hdr_tbl_at_very_end(img));
+    return SE::append_sections_help(img, new_sections, std::move(new_sections_contents), plan, base_vaddr, shift);
 }
 
 // ASSUMPTION: section header table is at the very end of file
-// TODO secitons align
-void SectionEditor::append_sections_help(std::string& content, 
+size_t SectionEditor::append_sections_help(ElfImage& img, 
                                     std::vector<section_descr>& new_sections, 
-                                    const std::vector<std::string>& new_sections_contents) {
-    Elf64_Ehdr e_hdr = get_elf_header(content);
+                                    std::vector<std::string> new_sections_contents,
+                                    const layout_plan& plan,
+                                    size_t base_vaddr,
+                                    size_t shift) {
+    Elf64_Ehdr e_hdr = img.header();
 
     assert(new_sections_contents.size() == new_sections.size());
-    assert(content.size() == e_hdr.e_shoff + e_hdr.e_shnum * e_hdr.e_shentsize);
-
-    auto actual_headers = SE::get_shdrs(content);
-    content.erase(e_hdr.e_shoff, e_hdr.e_shnum * e_hdr.e_shentsize);
-
-    assert(content.size() == e_hdr.e_shoff);
-    size_t pos0 = content.size();
-    
+    assert(plan.offsets.size() == new_sections.size());
+    assert(img.size() == e_hdr.e_shoff + e_hdr.e_shnum * e_hdr.e_shentsize);
 
+    std::string actual_headers = img.copy(e_hdr.e_shoff, e_hdr.e_shnum * e_hdr.e_shentsize);
+    img.truncate(e_hdr.e_shoff);
 
-    std::vector<size_t> paddings;
-    for (size_t i = 0; i < new_sections.size(); i++) {
-        size_t _pos0 = content.size();
-        size_t pad = section_insertion_addr(content, new_sections[i].first);
-        paddings.push_back(pad);
+    assert(img.size() == e_hdr.e_shoff);
+    // alignment holds for final offsets
+    size_t pos0 = (img.size() + shift + plan.align - 1) / plan.align * plan.align - shift;
 
-        content.append(pad, '\0');
-        content.append(new_sections_contents[i]);
-        assert(_pos0 + pad + new_sections_contents[i].size() == content.size());
-    }
-
-    e_hdr.e_shnum += new_sections.size();
-    e_hdr.e_shoff = content.size();
-
-    for (int i = 0; i < actual_headers.size(); i++) {
-        content.append((const char*) &actual_headers[i], e_hdr.e_shentsize);
-    }
+    // placement order differs from section header table order
+    std::vector<size_t> order(new_sections.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return plan.offsets[a] < plan.offsets[b];
+    });
 
-    size_t off = pos0;
-
-    for (size_t i = 0; i < new_sections.size(); i++) {
+    for (size_t i : order) {
         Elf64_Shdr& hdr = new_sections[i].first;
-
-        off += paddings[i];
-
-        hdr.sh_addr = BASE_REL + off + i * 0x200000;
+        size_t off = pos0 + plan.offsets[i];
+        // NOBITS ones (last in their segment) take no file bytes
+        if (hdr.sh_type != SHT_NOBITS) {
+            assert(off >= img.size());
+            assert(new_sections_contents[i].size() == hdr.sh_size);
+            img.append_zeros(off - img.size()); // stays hole in output file
+            img.append(std::move(new_sections_contents[i]));
+        }
+
+        // layout is mapped at `base_vaddr` wherever it is in file (offset may be huge)
+        hdr.sh_addr = base_vaddr + plan.offsets[i];
         hdr.sh_offset = off;
         hdr.sh_name = 0; // that value will be fullfilled by `add_moved_section_names` function
-
-        off += new_sections_contents[i].size();
     }
+    // file ends with last segment's file bytes (padding of huge RX included), not memory
+    size_t file_end = 0;
+    for (const segment_plan& seg : plan.segments)
+        file_end = std::max(file_end, seg.offset + seg.filesz);
+    if (pos0 + file_end > img.size())
+        img.append_zeros(pos0 + file_end - img.size());
 
-    for (int i = 0; i < new_sections.size(); i++) {
-        content.append((const char*) &new_sections[i], e_hdr.e_shentsize);
-    }
+    e_hdr.e_shoff = img.size();
+    img.append(actual_headers);
+    img.set_header(e_hdr);
 
-    // update elf header
-    content.replace(0, sizeof(Elf64_Ehdr), (const char*) &e_hdr, sizeof(Elf64_Ehdr));
+    for (size_t i = 0; i < new_sections.size(); i++) {
+        img.push_shdr(new_sections[i].first);
+    }
+    return pos0;
 }
 
-
-void SectionEditor::dump(const std::string& content, const std::string& out_file_path) {
-    std::ofstream out;
-    out.open(out_file_path);
-    out << content;
-    out.close();
-    std::string s("chmod 755 ");
-    s.append(out_file_path);
-    system(s.data());
+void SectionEditor::append_section(ElfImage& img, Elf64_Shdr hdr, std::string content) {
+    Elf64_Ehdr e_hdr = img.header();
+    assert(sec_hdr_tbl_at_very_end(img));
+
+    std::string actual_headers = img.copy(e_hdr.e_shoff, e_hdr.e_shnum * e_hdr.e_shentsize);
+    img.truncate(e_hdr.e_shoff);
+    hdr.sh_offset = section_insertion_addr(img.size(), hdr);
+    hdr.sh_size = content.size();
+    hdr.sh_name = 0;
+    img.append_zeros(hdr.sh_offset - img.size());
+    img.append(std::move(content));
+
+    // table keeps 8 byte alignment
+    e_hdr.e_shoff = (img.size() + sizeof(Elf64_Addr) - 1) / sizeof(Elf64_Addr) * sizeof(Elf64_Addr);
+    img.append_zeros(e_hdr.e_shoff - img.size());
+    img.append(std::move(actual_headers));
+    img.set_header(e_hdr);
+    img.push_shdr(hdr);
 }
 
 size_t SectionEditor::append(std::string& content, const std::string& what) {
@@ -212,44 +215,45 @@ size_t SectionEditor::append(std::string& content, const std::string& what) {
     return init_size;
 }
 
-inline size_t get_section_offset(const std::string& content, const std::string sec_name) {
-    return SE::find_section(sec_name, SE::get_shdrs(content)).sh_offset;
+inline size_t get_section_offset(const ElfImage& img, const std::string& sec_name) {
+    return img.section(sec_name).sh_offset;
 }
 
-size_t SE::section_insertion_padding(const std::string& content, Elf64_Shdr to_be_appended) {
+size_t SE::section_insertion_padding(size_t end, Elf64_Shdr to_be_appended) {
     const size_t align = to_be_appended.sh_addralign;
-    size_t addr = content.size();
+    size_t addr = end;
     for(uint i = 0; i <= align; i++) {
         if (addr % align == 0)
-            return addr - content.size();
+            return addr - end;
         addr++;
     }
     assert(false);
 }
 
-size_t SE::section_insertion_addr(const std::string& content, Elf64_Shdr to_be_appended) {
-    return content.size() + section_insertion_padding(content, to_be_appended);
+size_t SE::section_insertion_addr(size_t end, Elf64_Shdr to_be_appended) {
+    return end + section_insertion_padding(end, to_be_appended);
 }
 
-void SectionEditor::add_moved_section_names(std::string& content, 
+void SectionEditor::add_moved_section_names(ElfImage& img, 
                                                            std::vector<section_descr>& sections_to_move, 
-                                                           const std::string& prefix) {
+                                                           const std::string& prefix,
+                                                           bool zero_old) {
     std::vector<size_t> res;
 
-    size_t s0 = content.size();
-    Elf64_Shdr shstrtab_hdr = SE::find_section(".shstrtab", SE::get_shdrs(content));
+    Elf64_Shdr shstrtab_hdr = img.section(".shstrtab");
     size_t shstrtab_off = shstrtab_hdr.sh_offset;
     size_t shstrtab_size = shstrtab_hdr.sh_size;
-    Elf64_Ehdr ehdr = get_elf_header(content);
+    Elf64_Ehdr ehdr = img.header();
 
-    std::string shstrtab_content = content.substr(shstrtab_off, shstrtab_size);
+    std::string shstrtab_content = img.copy(shstrtab_off, shstrtab_size);
 
-    content.replace(shstrtab_off, shstrtab_size, shstrtab_size, '\0'); // we won't use it anymore
+    if (zero_old)
+        img.zero(shstrtab_off, shstrtab_size); // we won't use it anymore
 
-    size_t shstrtab_new_offset = section_insertion_addr(content, shstrtab_hdr);
-    content.append(shstrtab_new_offset - content.size(), '\0');
-    assert(content.size() == shstrtab_new_offset);
-    content.append(shstrtab_content);
+    size_t shstrtab_new_offset = section_insertion_addr(img.size(), shstrtab_hdr);
+    img.append_zeros(shstrtab_new_offset - img.size());
+    assert(img.size() == shstrtab_new_offset);
+    img.append(std::string_view(shstrtab_content));
 
     size_t sum_size = 0;
     for (auto& pair : sections_to_move) {
@@ -257,46 +261,37 @@ void SectionEditor::add_moved_section_names(std::string& content,
 
         std::string new_name = prefix + name;
 
-        size_t name_pos = content.size() - shstrtab_new_offset;
+        size_t name_pos = img.size() - shstrtab_new_offset;
         
         res.push_back(name_pos);
-        content.append(new_name.data(), new_name.size());
-
-        content.append("\0", 1);
+        // names are copied right behind table content - same piece
+        img.append(std::string_view(new_name.c_str(), new_name.size() + 1));
         sum_size += new_name.size() + 1;
     }
 
-    size_t shoff = SE::get_sh_offset(ehdr, ehdr.e_shstrndx);
-    Elf64_Shdr tmp;
-    std::memcpy(&tmp, &content[shoff], sizeof(Elf64_Shdr));
+    Elf64_Shdr tmp = img.shdrs()[ehdr.e_shstrndx].first;
     tmp.sh_offset = shstrtab_new_offset;
     tmp.sh_size += sum_size;
-    content.replace(shoff, sizeof(Elf64_Shdr), (const char *)&tmp, sizeof(Elf64_Shdr));
-
-    auto sec_hdrs = SE::get_shdrs(content);
+    img.set_shdr(ehdr.e_shstrndx, tmp);
 
+    // only moved sections (the last ones) get new names
+    size_t num_shdrs = img.shdrs().size();
     auto j = 0;
-    for (uint i = sec_hdrs.size() - sections_to_move.size(); i < sec_hdrs.size(); i++) {
-        sec_hdrs[i].first.sh_name = res[j];
+    for (size_t i = num_shdrs - sections_to_move.size(); i < num_shdrs; i++) {
+        Elf64_Shdr hdr = img.shdrs()[i].first;
+        hdr.sh_name = res[j];
+        img.set_shdr(i, hdr);
         j++;
     }
-
-    replace_sec_hdr_tbl(content, sec_hdrs);
 }
 
 
-void SectionEditor::replace_sec_hdr_tbl(std::string& content, std::vector<section_descr>& new_tbl) {
-    Elf64_Ehdr e_hdr = get_elf_header(content);
-    
-    assert(new_tbl.size() == e_hdr.e_shnum);
-    size_t begin = e_hdr.e_shoff;
-    size_t ent_size = e_hdr.e_shentsize;
+void SectionEditor::replace_sec_hdr_tbl(ElfImage& img, std::vector<section_descr>& new_tbl) {
+    assert(new_tbl.size() == img.header().e_shnum);
+    size_t s1 = img.size();
     
     for (size_t i = 0; i < new_tbl.size(); i++) {
-        size_t addr = begin + i * ent_size;
-        size_t s1 = content.size();
-        content.replace(addr, ent_size, (const char*) &new_tbl[i].first, ent_size);
-        size_t s2 = content.size();
-        assert(s1 == s2);
+        img.set_shdr(i, new_tbl[i].first);
     }
+    assert(s1 == img.size());
 }
\ No newline at end of file
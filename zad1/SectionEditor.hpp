@@ -1,28 +1,30 @@
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <elf.h>
 #include <vector>
 #include <cassert>
 #include <algorithm>
 
-
-using section_descr = std::pair<Elf64_Shdr, std::string> ;
-
-extern size_t BASE_REL;
+#include "ElfImage.hpp"
+#include "Layout.hpp"
 
 // `content` argument always means elf file content 
 class SectionEditor {
 private:
-    static std::string get_section_content(const std::string& content, Elf64_Shdr section_hdr);
+    static std::string get_section_content(std::string_view content, Elf64_Shdr section_hdr);
 
 
-    static void append_sections_help(std::string& content, 
+    static size_t append_sections_help(ElfImage& img, 
                                     std::vector<section_descr>& new_sections, 
-                                    const std::vector<std::string>& new_sections_contents);
+                                    std::vector<std::string> new_sections_contents,
+                                    const layout_plan& plan,
+                                    size_t base_vaddr,
+                                    size_t shift);
 
-    static size_t section_insertion_addr(const std::string& content, Elf64_Shdr to_be_appended);
+    static size_t section_insertion_addr(size_t end, Elf64_Shdr to_be_appended);
 
-    static size_t section_insertion_padding(const std::string& content, Elf64_Shdr to_be_appended);
+    static size_t section_insertion_padding(size_t end, Elf64_Shdr to_be_appended);
     
 public:
 
@@ -42,14 +44,16 @@ public:
      * Get address of exact section header offset.
      * Called with num=0 returns adress of section header table.
      **/
-    inline static size_t get_sh_offset(Elf64_Ehdr hdr, size_t num);
+    inline static size_t get_sh_offset(const Elf64_Ehdr& hdr, size_t num) {
+        return hdr.e_shoff + (num * hdr.e_shentsize);
+    }
 
-    static std::string get_section_content(const std::string& content, const std::string& name);
+    static std::string get_section_content(std::string_view content, const std::string& name);
 
     /**
      * Returns vector of all sections headers with it's names.
      **/
-    static std::vector<section_descr> get_shdrs(const std::string& content);
+    static std::vector<section_descr> get_shdrs(std::string_view content);
 
     /**
      * Returns last number of byte that belongs to given section.
@@ -62,9 +66,22 @@ public:
 
     static void add_offset(std::string& content, const std::string& sec_name, size_t num);
 
-    static void append_sections(std::string& content, 
+    /**
+     * Appends sections to the end of file, placed according to `plan`.
+     * `shift` bytes will be inserted at the beginning of file later (layout
+     * is aligned for final offsets). Whole layout is mapped at `base_vaddr`,
+     * which must be aligned to `plan.align`.
+     * Contents are moved into image as separate pieces, padding becomes hole.
+     * NOBITS sections (with empty contents) get offsets but no bytes - file
+     * ends with the last byte of segments' p_filesz.
+     * Returns file offset of layout start.
+     **/
+    static size_t append_sections(ElfImage& img, 
                                     std::vector<section_descr>& new_sections, 
-                                    const std::vector<std::string>& new_sections_contents);
+                                    std::vector<std::string> new_sections_contents,
+                                    const layout_plan& plan,
+                                    size_t base_vaddr,
+                                    size_t shift);
     /**
      * Inserts `what` string to end of `sec_name` section.
      * Returns position of insertion beginning.
@@ -84,16 +101,25 @@ public:
      */
     static size_t append(std::string& content, const std::string& what);
 
-    static void dump(const std::string& content, const std::string& out_file_path);
+    /**
+     * Appends non-alloc section `content` (described by `hdr`, its offset is set here)
+     * behind the last byte, moving section header table behind it.
+     * Section header table must be at the very end of file.
+     * Its name is left for `add_moved_section_names`.
+     **/
+    static void append_section(ElfImage& img, Elf64_Shdr hdr, std::string content);
 
     /**
-     * Returns vector of positions of inserted section names.
+     * Names last sections of the table `prefix` + names of `sections_to_move`:
+     * .shstrtab is copied to the end of file with them appended.
+     * Old copy is zeroed, unless `zero_old` is false.
      */
-    static void add_moved_section_names(std::string&, std::vector<section_descr>&, const std::string& prefix);
+    static void add_moved_section_names(ElfImage&, std::vector<section_descr>&, const std::string& prefix,
+                                        bool zero_old = true);
 
-    static void replace_sec_hdr_tbl(std::string& content, std::vector<section_descr>& new_tbl);
+    static void replace_sec_hdr_tbl(ElfImage& img, std::vector<section_descr>& new_tbl);
 
-    static size_t get_section_vaddr(const std::string& content, const std::string& name);
+    static size_t get_section_vaddr(const ElfImage& img, const std::string& name);
 
-    static size_t get_section_idx(const std::string& content, const std::string& name);
+    static size_t get_section_idx(const ElfImage& img, const std::string& name);
 };
\ No newline at end of file
@@ -0,0 +1,49 @@
+#include <cstdlib>
+#include <new>
+#include <sys/resource.h>
+
+#include "Stats.hpp"
+
+thread_local JobCounters* current_counters = nullptr;
+
+void JobCounters::add(const JobCounters& other) {
+    allocations += other.allocations;
+    allocated_bytes += other.allocated_bytes;
+    bytes_copied += other.bytes_copied;
+    bytes_written += other.bytes_written;
+    bytes_copied_in_kernel += other.bytes_copied_in_kernel;
+    bytes_cloned += other.bytes_cloned;
+    symbol_lookups += other.symbol_lookups;
+    cache_hits += other.cache_hits;
+    bytes_merged += other.bytes_merged;
+    bytes_folded += other.bytes_folded;
+    call_sites_rewritten += other.call_sites_rewritten;
+    for (size_t i = 0; i <= R_X86_64_NUM; i++)
+        relocations[i] += other.relocations[i];
+    relocations_skipped += other.relocations_skipped;
+}
+
+long peak_rss_kb() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+// every allocation of the program goes through these, counting costs one TLS load
+void* operator new(size_t n) {
+    if (current_counters != nullptr) {
+        current_counters->allocations++;
+        current_counters->allocated_bytes += n;
+    }
+    if (void* p = malloc(n == 0 ? 1 : n))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <elf.h>
+#include <utility>
+#include <vector>
+
+/**
+ * Counters of one job. They are collected by thread running it, only while
+ * StatsScope is alive - concurrent jobs of batch mode don't mix.
+ **/
+struct JobCounters {
+    size_t allocations = 0; // operator new calls
+    size_t allocated_bytes = 0;
+    size_t bytes_copied = 0; // copied in memory (from inputs or between buffers)
+    size_t bytes_written = 0; // pwrite to output
+    size_t bytes_copied_in_kernel = 0; // copy_file_range to output
+    size_t bytes_cloned = 0; // shared with input by FICLONE
+    size_t symbol_lookups = 0;
+    size_t cache_hits = 0; // outputs taken from --cache-dir
+    size_t bytes_merged = 0; // of SHF_MERGE sections, not stored thanks to equal entries
+    size_t bytes_folded = 0; // of code sections not stored thanks to identical ones (--icf)
+    size_t call_sites_rewritten = 0; // of ET_EXEC, to go straight to detour targets (--rewrite-calls)
+    size_t relocations[R_X86_64_NUM + 1] = {}; // by type, unknown ones counted as R_X86_64_NUM
+    size_t relocations_skipped = 0; // of unsupported type
+
+    // adds counters of part of the job done by another thread
+    void add(const JobCounters& other);
+};
+
+/**
+ * Times of stages (in order) and counters of one job, see `link`.
+ **/
+struct LinkStats {
+    std::vector<std::pair<const char*, double>> phases; // name, seconds
+    JobCounters counters;
+    long peak_rss_kb = 0; // of whole process
+};
+
+// counters of job run by this thread, nullptr if not collected
+extern thread_local JobCounters* current_counters;
+
+/**
+ * Makes `counters` current for this thread until destroyed (nullptr disables).
+ **/
+class StatsScope {
+private:
+    JobCounters* prev;
+
+public:
+    explicit StatsScope(JobCounters* counters) : prev(current_counters) { current_counters = counters; }
+    ~StatsScope() { current_counters = prev; }
+    StatsScope(const StatsScope&) = delete;
+    StatsScope& operator=(const StatsScope&) = delete;
+};
+
+/**
+ * Appends its lifetime as `name` phase to `stats` (if not nullptr).
+ **/
+class ScopedPhase {
+private:
+    using clock = std::chrono::steady_clock;
+    LinkStats* stats;
+    const char* name;
+    clock::time_point t0 = clock::now();
+
+public:
+    ScopedPhase(LinkStats* stats, const char* name) : stats(stats), name(name) {}
+    ~ScopedPhase() {
+        if (stats != nullptr)
+            stats->phases.emplace_back(name, std::chrono::duration<double>(clock::now() - t0).count());
+    }
+    ScopedPhase(const ScopedPhase&) = delete;
+    ScopedPhase& operator=(const ScopedPhase&) = delete;
+};
+
+inline void count_copied(size_t n) {
+    if (current_counters != nullptr)
+        current_counters->bytes_copied += n;
+}
+
+inline void count_written(size_t n) {
+    if (current_counters != nullptr)
+        current_counters->bytes_written += n;
+}
+
+inline void count_copied_in_kernel(size_t n) {
+    if (current_counters != nullptr)
+        current_counters->bytes_copied_in_kernel += n;
+}
+
+inline void count_cloned(size_t n) {
+    if (current_counters != nullptr)
+        current_counters->bytes_cloned += n;
+}
+
+inline void count_symbol_lookup() {
+    if (current_counters != nullptr)
+        current_counters->symbol_lookups++;
+}
+
+inline void count_relocation(unsigned type, bool applied) {
+    if (current_counters == nullptr)
+        return;
+    current_counters->relocations[std::min<unsigned>(type, R_X86_64_NUM)]++;
+    if (!applied)
+        current_counters->relocations_skipped++;
+}
+
+/**
+ * Peak resident set size of this process so far.
+ **/
+long peak_rss_kb();
@@ -0,0 +1,83 @@
+#include <cassert>
+#include <cstring>
+
+#include "SymbolIndex.hpp"
+#include "Stats.hpp"
+
+std::vector<symbol_descr> get_symbols(const ElfImage& img) {
+    const Elf64_Shdr& symtab = img.section(".symtab");
+    std::string_view content = img.section_content(symtab);
+    std::string_view strtab_content = img.section_content(".strtab");
+    std::vector<symbol_descr> res;
+
+    assert(symtab.sh_size % sizeof(Elf64_Sym) == 0);
+    for (size_t i = 0; i < symtab.sh_size; i+=sizeof(Elf64_Sym)) {
+        Elf64_Sym sym;
+        memcpy(&sym, &content.data()[i], sizeof(Elf64_Sym));
+        std::string s(&strtab_content.data()[sym.st_name]); // to first null char
+        res.push_back(std::make_pair(sym, s));
+    }
+    return res;
+}
+
+// FNV-1a
+uint32_t SymbolIndex::hash(std::string_view name) {
+    uint32_t h = 2166136261u;
+    for (char c : name) {
+        h ^= (unsigned char) c;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+SymbolIndex::SymbolIndex(const ElfImage& img) : strtab(img.section_content(".strtab")) {
+    const Elf64_Shdr& symtab = img.section(".symtab");
+    std::string_view content = img.section_content(symtab);
+
+    assert(symtab.sh_size % sizeof(Elf64_Sym) == 0);
+    size_t num = symtab.sh_size / sizeof(Elf64_Sym);
+    symbols.resize(num);
+    memcpy(symbols.data(), content.data(), num * sizeof(Elf64_Sym));
+
+    names.reserve(num);
+    for (const Elf64_Sym& sym : symbols) {
+        names.push_back(std::string_view(&strtab.data()[sym.st_name])); // to first null char
+    }
+
+    // keep load factor below 1/2
+    size_t cap = 16;
+    while (cap < 2 * num)
+        cap *= 2;
+    slots.assign(cap, Slot{0, 0});
+    mask = cap - 1;
+
+    for (size_t i = 0; i < num; i++) {
+        if (!names[i].empty())
+            insert(i);
+    }
+}
+
+void SymbolIndex::insert(size_t idx) {
+    uint32_t h = hash(names[idx]);
+    for (size_t pos = h & mask; ; pos = (pos + 1) & mask) {
+        Slot& slot = slots[pos];
+        if (slot.idx == 0) {
+            slot = Slot{h, (uint32_t) idx + 1};
+            return;
+        }
+        if (slot.hash == h && names[slot.idx - 1] == names[idx])
+            return; // first one stays
+    }
+}
+
+size_t SymbolIndex::find(std::string_view name) const {
+    count_symbol_lookup();
+    uint32_t h = hash(name);
+    for (size_t pos = h & mask; ; pos = (pos + 1) & mask) {
+        const Slot& slot = slots[pos];
+        if (slot.idx == 0)
+            return npos;
+        if (slot.hash == h && names[slot.idx - 1] == name)
+            return slot.idx - 1;
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <elf.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ElfImage.hpp"
+
+using symbol_descr = std::pair<Elf64_Sym, std::string>;
+
+/**
+ * Returns vector of all .symtab entries with their names.
+ **/
+std::vector<symbol_descr> get_symbols(const ElfImage& img);
+
+/**
+ * Name -> .symtab entry lookup table, built once per image.
+ * Open-addressing (linear probing) hash table over string_views into
+ * index's own copy of .strtab, so it stays valid while image content changes.
+ * For duplicated names first entry in .symtab order wins, same as linear scan.
+ **/
+class SymbolIndex {
+private:
+    struct Slot {
+        uint32_t hash;
+        uint32_t idx; // .symtab index + 1, 0 means empty slot
+    };
+
+    std::string strtab;
+    std::vector<Elf64_Sym> symbols;
+    std::vector<std::string_view> names;
+    std::vector<Slot> slots;
+    size_t mask = 0;
+
+    static uint32_t hash(std::string_view name);
+
+    void insert(size_t idx);
+
+public:
+    static const size_t npos = -1;
+
+    explicit SymbolIndex(const ElfImage& img);
+
+    SymbolIndex(const SymbolIndex&) = delete;
+    SymbolIndex& operator=(const SymbolIndex&) = delete;
+
+    size_t size() const { return symbols.size(); }
+
+    const Elf64_Sym& at(size_t idx) const { return symbols[idx]; }
+
+    std::string_view name(size_t idx) const { return names[idx]; }
+
+    symbol_descr descr(size_t idx) const { return std::make_pair(symbols[idx], std::string(names[idx])); }
+
+    /**
+     * Returns .symtab index of first symbol named `name`, or npos.
+     * Symbols with empty names are not indexed.
+     **/
+    size_t find(std::string_view name) const;
+};
@@ -1,5 +1,6 @@
 #include <elf.h>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <iostream>
 #include <cstring>
@@ -12,7 +13,7 @@ void integrity_check(Elf64_Ehdr h);
  * Reads ELF header from given file content.
  * Does integrity check, in case of error throws exception.
  **/
-Elf64_Ehdr get_elf_header(const std::string& content);
+Elf64_Ehdr get_elf_header(std::string_view content);
 
 
 /**
@@ -24,7 +25,7 @@ inline size_t get_ph_offset(Elf64_Ehdr hdr, size_t num);
 /**
  * Returns vector of all program headers.
  **/
-std::vector<Elf64_Phdr> get_phs(const std::string& content);
+std::vector<Elf64_Phdr> get_phs(std::string_view content);
 
 
 void print_program_header(Elf64_Phdr h);
@@ -38,7 +39,7 @@ struct DataComparer {
     }
 };
 
-std::map<Elf64_Phdr, std::vector<Elf64_Shdr>, DataComparer<Elf64_Phdr>> sec2seg_map(const std::string& content);
+std::map<Elf64_Phdr, std::vector<Elf64_Shdr>, DataComparer<Elf64_Phdr>> sec2seg_map(std::string_view content);
 
 
 void replace_pdhr_tbl(std::string& content, std::vector<Elf64_Phdr> new_tbl);
\ No newline at end of file
@@ -0,0 +1,83 @@
+#include "WorkerPool.hpp"
+
+WorkerPool::WorkerPool(size_t num_threads) {
+    if (num_threads == 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (size_t i = 0; i < num_threads; i++)
+        queues.push_back(std::make_unique<Queue>());
+    for (size_t i = 0; i < num_threads; i++)
+        threads.emplace_back(&WorkerPool::worker, this, i);
+}
+
+WorkerPool::~WorkerPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_cv.notify_all();
+    for (auto& t : threads)
+        t.join();
+}
+
+void WorkerPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Queue& target = *queues[next++ % queues.size()];
+        std::lock_guard<std::mutex> queue_lock(target.mutex);
+        target.tasks.push_back(std::move(task));
+        queued++;
+        pending++;
+    }
+    work_cv.notify_one();
+}
+
+bool WorkerPool::try_pop(size_t self, std::function<void()>& task) {
+    {
+        Queue& own = *queues[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < queues.size(); i++) {
+        Queue& victim = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkerPool::worker(size_t self) {
+    while (true) {
+        std::function<void()> task;
+        if (try_pop(self, task)) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queued--;
+            }
+            task();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0)
+                done_cv.notify_all();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        work_cv.wait(lock, [this]() { return queued > 0 || stopping; });
+        if (stopping && queued == 0)
+            return;
+    }
+}
+
+void WorkerPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [this]() { return pending == 0; });
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed-size thread pool with work stealing.
+ * Every worker has own task queue: it takes tasks from the back of own queue,
+ * and when it's empty, steals from the front of other workers' queues.
+ * Tasks must not throw.
+ **/
+class WorkerPool {
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+
+    std::mutex mutex; // guards everything below
+    std::condition_variable work_cv;
+    std::condition_variable done_cv;
+    size_t queued = 0;  // tasks waiting in queues
+    size_t pending = 0; // tasks submitted, but not finished yet
+    size_t next = 0;    // queue that gets next submitted task
+    bool stopping = false;
+
+    bool try_pop(size_t self, std::function<void()>& task);
+
+    void worker(size_t self);
+
+public:
+    /**
+     * `num_threads` == 0 means one thread per core.
+     **/
+    explicit WorkerPool(size_t num_threads);
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /**
+     * Waits for all submitted tasks and joins threads.
+     **/
+    ~WorkerPool();
+
+    size_t size() const { return threads.size(); }
+
+    void submit(std::function<void()> task);
+
+    /**
+     * Blocks until all submitted tasks are finished.
+     **/
+    void wait();
+};
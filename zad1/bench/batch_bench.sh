@@ -0,0 +1,28 @@
+#!/bin/bash
+# Batch mode throughput (jobs per second) against number of worker threads.
+# Uses test binaries from z1/ (run `make` there first).
+#
+# Usage: ./bench/batch_bench.sh [copies of each test job, default 50]
+
+COPIES=${1:-50}
+DIR=$(dirname "$0")/..
+OUT=$(mktemp -d)
+MANIFEST=$OUT/manifest
+
+cd "$DIR/z1" || exit 1
+for i in $(seq "$COPIES"); do
+	for tst in syscall syscall2 call noop rw ro def var static; do
+		echo "exec_${tst} rel_${tst}.o $OUT/patched_${tst}_$i" >> "$MANIFEST"
+	done
+done
+
+THREADS=1
+while [ "$THREADS" -le "$(nproc)" ]; do
+	../postlinker --batch "$MANIFEST" -j "$THREADS" 2> /dev/null | grep '^\[INFO\]'
+	THREADS=$((THREADS * 2))
+done
+if [ "$((THREADS / 2))" -ne "$(nproc)" ]; then
+	../postlinker --batch "$MANIFEST" -j "$(nproc)" 2> /dev/null | grep '^\[INFO\]'
+fi
+
+rm -rf "$OUT"
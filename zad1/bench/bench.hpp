@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * Small helpers shared by benchmarks.
+ * Each measured variant is run in forked child, so that
+ * peak RSS (ru_maxrss) of one variant doesn't hide another.
+ **/
+
+inline double now_sec() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+inline long peak_rss_kb() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+/**
+ * Runs `fn` in child process and prints one result line:
+ * `name`, wall time of `fn` and peak RSS of child.
+ **/
+inline void run_isolated(const char* name, const std::function<void()>& fn) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        double t0 = now_sec();
+        fn();
+        double t1 = now_sec();
+        printf("%-24s %10.3f ms %10ld KB peak RSS\n", name, (t1 - t0) * 1000, peak_rss_kb());
+        fflush(stdout);
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+}
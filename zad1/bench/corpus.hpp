@@ -0,0 +1,191 @@
+#pragma once
+
+#include <elf.h>
+#include <fcntl.h>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "synth.hpp"
+
+/**
+ * Synthetic ET_EXEC + ET_REL pair for benchmarking the whole postlinker.
+ * Not meant to be run - only to be linked.
+ *
+ * ET_EXEC: .text with `symbols` global symbols (in .symtab) and `exec_size`
+ * more bytes in non-alloc section (written sparse or dense).
+ * ET_REL: `sections` allocatable sections (.text, .data, .rodata in turn),
+ * `_start` and `relocs` relocations spread over them, each one against
+ * one of ET_EXEC's symbols or section of ET_REL, of type drawn from `mix`.
+ **/
+struct CorpusSpec {
+    size_t sections = 8;
+    size_t symbols = 1000;
+    size_t relocs = 1000;
+    std::map<unsigned, unsigned> mix = {
+        {R_X86_64_PC32, 1}, {R_X86_64_PLT32, 1}, {R_X86_64_32S, 1}, {R_X86_64_64, 1},
+    }; // type -> weight
+    size_t exec_size = 0;
+    bool sparse = false;
+};
+
+/**
+ * Parses `pc32=2,plt32=1,32s=1,64=1` (weights of relocation types).
+ * Throws std::invalid_argument on unknown type.
+ **/
+inline std::map<unsigned, unsigned> parse_reloc_mix(const std::string& str) {
+    static const std::map<std::string, unsigned> types = {
+        {"pc32", R_X86_64_PC32}, {"plt32", R_X86_64_PLT32}, {"32", R_X86_64_32},
+        {"32s", R_X86_64_32S}, {"64", R_X86_64_64}, {"pc64", R_X86_64_PC64},
+    };
+    std::map<unsigned, unsigned> res;
+    size_t pos = 0;
+    while (pos < str.size()) {
+        size_t end = str.find(',', pos);
+        if (end == std::string::npos)
+            end = str.size();
+        std::string item = str.substr(pos, end - pos);
+        size_t eq = item.find('=');
+        auto it = types.find(item.substr(0, eq));
+        if (it == types.end())
+            throw std::invalid_argument("unknown relocation type " + item);
+        res[it->second] = eq == std::string::npos ? 1 : std::stoul(item.substr(eq + 1));
+        pos = end + 1;
+    }
+    return res;
+}
+
+inline std::string corpus_exec(const CorpusSpec& spec) {
+    SynthElf elf;
+    size_t text = elf.add_section(".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
+                                  std::string(std::max<size_t>(16 * spec.symbols, 16), '\xc3'), 0x401000, 16);
+    elf.add_load(text);
+    synth_add_symtab(elf, spec.symbols);
+    return elf.build();
+}
+
+inline std::string corpus_rel(const CorpusSpec& spec) {
+    static const char* const kinds[] = {".text", ".data", ".rodata"};
+    static const Elf64_Xword flags[] = {SHF_ALLOC | SHF_EXECINSTR, SHF_ALLOC | SHF_WRITE, SHF_ALLOC};
+    const size_t num_secs = std::max<size_t>(spec.sections, 1);
+    const size_t num_ext = std::min(spec.symbols, spec.relocs);
+
+    // section i: slots of 8 bytes for its relocations
+    std::vector<size_t> slots(num_secs, 0);
+    for (size_t j = 0; j < spec.relocs; j++)
+        slots[j % num_secs]++;
+
+    SynthElf elf;
+    elf.type = ET_REL;
+    std::vector<size_t> sec_idx;
+    for (size_t i = 0; i < num_secs; i++) {
+        std::string name = std::string(kinds[i % 3]) + "." + std::to_string(i);
+        sec_idx.push_back(elf.add_section(name, SHT_PROGBITS, flags[i % 3],
+                                          std::string(std::max<size_t>(8 * slots[i], 8), '\0'), 0, 16));
+    }
+
+    // locals: null, section symbols; globals: _start, ET_EXEC's sym_*
+    std::string strtab(1, '\0');
+    std::string symtab(sizeof(Elf64_Sym), '\0');
+    auto add_sym = [&](const std::string& name, unsigned char info, Elf64_Section shndx) {
+        Elf64_Sym sym{};
+        if (!name.empty()) {
+            sym.st_name = strtab.size();
+            strtab += name;
+            strtab.push_back('\0');
+        }
+        sym.st_info = info;
+        sym.st_shndx = shndx;
+        symtab.append((const char*) &sym, sizeof(sym));
+    };
+    for (size_t i = 0; i < num_secs; i++)
+        add_sym("", ELF64_ST_INFO(STB_LOCAL, STT_SECTION), sec_idx[i]);
+    const size_t first_global = num_secs + 1;
+    add_sym("_start", ELF64_ST_INFO(STB_GLOBAL, STT_FUNC), sec_idx[0]);
+    for (size_t i = 0; i < num_ext; i++)
+        add_sym("sym_" + std::to_string(i), ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE), SHN_UNDEF);
+
+    std::vector<unsigned> types;
+    std::vector<unsigned> weights;
+    for (const auto& [type, weight] : spec.mix) {
+        types.push_back(type);
+        weights.push_back(weight);
+    }
+    std::mt19937 gen(spec.relocs);
+    std::discrete_distribution<size_t> pick_type(weights.begin(), weights.end());
+
+    // symtab and strtab go after all .rela sections
+    const size_t symtab_idx = sec_idx.back() + num_secs + 1;
+    std::vector<std::string> relas(num_secs);
+    for (size_t j = 0; j < spec.relocs; j++) {
+        size_t s = j % num_secs;
+        unsigned type = types.empty() ? R_X86_64_64 : types[pick_type(gen)];
+        bool pc = type == R_X86_64_PC32 || type == R_X86_64_PLT32 || type == R_X86_64_PC64;
+        // every other relocation points into ET_REL itself
+        size_t sym = j % 2 == 0 && num_ext > 0 ? first_global + 1 + j / 2 % num_ext : 1 + j / 2 % num_secs;
+        Elf64_Rela r{};
+        r.r_offset = 8 * (j / num_secs);
+        r.r_info = ELF64_R_INFO(sym, type);
+        r.r_addend = pc ? -4 : 0;
+        relas[s].append((const char*) &r, sizeof(r));
+    }
+    for (size_t i = 0; i < num_secs; i++)
+        elf.add_section(".rela" + elf.names[sec_idx[i]], SHT_RELA, SHF_INFO_LINK, relas[i], 0, 8,
+                        symtab_idx, sec_idx[i], sizeof(Elf64_Rela));
+
+    elf.add_section(".symtab", SHT_SYMTAB, 0, symtab, 0, 8, symtab_idx + 1, first_global, sizeof(Elf64_Sym));
+    elf.add_section(".strtab", SHT_STRTAB, 0, strtab);
+    return elf.build();
+}
+
+/**
+ * Writes ELF `content` to `path`. With `extra` > 0, non-alloc section of that
+ * size is added behind content (section header table goes after it) - holes
+ * only if `sparse`, otherwise written out.
+ * Throws std::runtime_error on failure.
+ **/
+inline void corpus_write(const std::string& path, std::string content, size_t extra = 0, bool sparse = false) {
+    int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0755);
+    if (fd < 0)
+        throw std::runtime_error("cannot write " + path);
+    auto write_at = [&](const void* buf, size_t n, size_t off) {
+        if (pwrite(fd, buf, n, off) != (ssize_t) n) {
+            close(fd);
+            throw std::runtime_error("cannot write " + path);
+        }
+    };
+
+    Elf64_Ehdr ehdr;
+    memcpy(&ehdr, content.data(), sizeof(ehdr));
+    std::string table = content.substr(ehdr.e_shoff);
+    content.resize(ehdr.e_shoff);
+    if (extra > 0) {
+        Elf64_Shdr bulk{};
+        bulk.sh_type = SHT_PROGBITS;
+        bulk.sh_offset = (content.size() + 0xfff) / 0x1000 * 0x1000;
+        bulk.sh_size = extra;
+        bulk.sh_addralign = 1;
+        table.append((const char*) &bulk, sizeof(bulk));
+        ehdr.e_shoff = (bulk.sh_offset + extra + 7) / 8 * 8;
+        ehdr.e_shnum++;
+        memcpy(&content[0], &ehdr, sizeof(ehdr));
+
+        std::string chunk(1 << 20, '\x5a');
+        for (size_t off = 0; !sparse && off < extra; off += chunk.size())
+            write_at(chunk.data(), std::min(chunk.size(), extra - off), bulk.sh_offset + off);
+    }
+    write_at(content.data(), content.size(), 0);
+    write_at(table.data(), table.size(), ehdr.e_shoff);
+    close(fd);
+}
+
+/**
+ * Writes `dir`/exec and `dir`/rel.o for `spec`.
+ **/
+inline void corpus_generate(const CorpusSpec& spec, const std::string& dir) {
+    corpus_write(dir + "/exec", corpus_exec(spec), spec.exec_size, spec.sparse);
+    corpus_write(dir + "/rel.o", corpus_rel(spec));
+}
@@ -0,0 +1,62 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "corpus.hpp"
+
+/**
+ * Writes synthetic <dir>/exec (ET_EXEC) and <dir>/rel.o (ET_REL) for
+ * benchmarking, see CorpusSpec.
+ *
+ * Usage: ./bench/corpus_gen <dir> [--sections N] [--symbols N] [--relocs N]
+ *        [--mix pc32=1,plt32=1,32s=1,64=1] [--size BYTES[K|M|G]] [--sparse]
+ **/
+
+static size_t parse_size(const std::string& str) {
+    size_t pos;
+    size_t res = std::stoull(str, &pos);
+    switch (pos < str.size() ? str[pos] : 0) {
+    case 'G': res <<= 10; // fall through
+    case 'M': res <<= 10; // fall through
+    case 'K': res <<= 10;
+    }
+    return res;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <dir> [--sections N] [--symbols N] [--relocs N] "
+                        "[--mix pc32=1,plt32=1,32s=1,64=1] [--size BYTES[K|M|G]] [--sparse]\n", argv[0]);
+        return 1;
+    }
+
+    CorpusSpec spec;
+    try {
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--sparse") {
+                spec.sparse = true;
+                continue;
+            }
+            if (i + 1 == argc)
+                throw std::invalid_argument("missing value of " + arg);
+            std::string val = argv[++i];
+            if (arg == "--sections")
+                spec.sections = std::stoul(val);
+            else if (arg == "--symbols")
+                spec.symbols = std::stoul(val);
+            else if (arg == "--relocs")
+                spec.relocs = std::stoul(val);
+            else if (arg == "--mix")
+                spec.mix = parse_reloc_mix(val);
+            else if (arg == "--size")
+                spec.exec_size = parse_size(val);
+            else
+                throw std::invalid_argument("unknown option " + arg);
+        }
+        corpus_generate(spec, argv[1]);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+}
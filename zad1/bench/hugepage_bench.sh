@@ -0,0 +1,65 @@
+#!/bin/bash
+# iTLB cost of injected hot code with default layout and with --huge-rx.
+# ET_REL has NUM_FUNCS functions, each on its own 4KB page, called in a tight
+# loop from its `_start`. Before the loop it asks for huge page with
+# MADV_COLLAPSE and exits with 0 only if that succeeded.
+# Uses exec_call from z1/ (run `make` there first).
+#
+# Usage: ./bench/hugepage_bench.sh [postlinker, default ./postlinker] [iterations, default 20000]
+
+DIR=$(realpath "$(dirname "$0")/..")
+POSTLINKER=$(realpath "${1:-$DIR/postlinker}")
+ITERS=${2:-20000}
+NUM_FUNCS=256
+OUT=$(mktemp -d)
+
+{
+	for i in $(seq 0 $((NUM_FUNCS - 1))); do
+		echo "__attribute__((noinline, aligned(4096))) int f$i(int x) { return x * 3 + $i; }"
+	done
+	echo "int (*const funcs[])(int) = {"
+	for i in $(seq 0 $((NUM_FUNCS - 1))); do
+		echo "f$i,"
+	done
+	echo "};"
+	cat << EOF
+static long sys3(long n, long a, long b, long c) {
+	long res;
+	__asm__ volatile("syscall" : "=a"(res) : "a"(n), "D"(a), "S"(b), "d"(c) : "rcx", "r11", "memory");
+	return res;
+}
+
+volatile int sink;
+
+int bench_main(void) {
+	unsigned long code = (unsigned long) &f0 & ~0x1fffffUL;
+	long collapsed = sys3(28 /* madvise */, code, 0x200000, 25 /* MADV_COLLAPSE */);
+
+	int acc = 0;
+	for (long i = 0; i < $ITERS; i++)
+		for (int j = 0; j < $NUM_FUNCS; j++)
+			acc = funcs[j](acc);
+	sink = acc;
+	return collapsed != 0;
+}
+
+__asm__(
+	".global _start\n"
+	"_start:\n"
+	"and \$-16, %rsp\n"
+	"call bench_main\n"
+	"mov %eax, %edi\n"
+	"mov \$60, %eax\n"
+	"syscall\n"
+);
+EOF
+} > "$OUT/hot.c"
+gcc -O1 -fno-common -c -o "$OUT/hot.o" "$OUT/hot.c" || exit 1
+
+"$POSTLINKER" "$DIR/z1/exec_call" "$OUT/hot.o" "$OUT/default" > /dev/null || exit 1
+"$POSTLINKER" --huge-rx "$DIR/z1/exec_call" "$OUT/hot.o" "$OUT/huge_rx" > /dev/null || exit 1
+
+"$DIR/bench/itlb_bench" "$OUT/default" "$OUT/huge_rx"
+ls -ls "$OUT/default" "$OUT/huge_rx" | awk '{ printf "%-40s %10d bytes, %8d KB on disk\n", $10, $6, $1 }'
+
+rm -rf "$OUT"
@@ -0,0 +1,92 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.hpp"
+
+/**
+ * iTLB misses (user space) of whole run of each binary, counted with
+ * perf_event_open. When hardware counters are not available (e.g. in VM)
+ * only wall time is reported.
+ * Exit status of binary is printed too - binaries built by hugepage_bench.sh
+ * return 0 when MADV_COLLAPSE managed to back their code with huge page.
+ *
+ * Usage: ./bench/itlb_bench <binary>...
+ **/
+
+static int open_counter(pid_t pid, unsigned type, unsigned long long config) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+static void print_count(int fd) {
+    long long count;
+    if (fd >= 0 && read(fd, &count, sizeof(count)) == sizeof(count))
+        printf(" %14lld", count);
+    else
+        printf(" %14s", "n/a");
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <binary>...\n", argv[0]);
+        return 1;
+    }
+
+    const unsigned long long itlb_misses = PERF_COUNT_HW_CACHE_ITLB
+        | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+    printf("%-32s %6s %10s %14s %14s\n", "binary", "status", "time [ms]", "iTLB misses", "instructions");
+    for (int i = 1; i < argc; i++) {
+        // child waits until counters are attached, they start counting at exec
+        int go[2];
+        if (pipe(go) != 0)
+            return 1;
+        pid_t pid = fork();
+        if (pid == 0) {
+            char c;
+            close(go[1]);
+            if (read(go[0], &c, 1) != 1)
+                _exit(127);
+            execl(argv[i], argv[i], (char*) nullptr);
+            _exit(127);
+        }
+        close(go[0]);
+
+        int itlb = open_counter(pid, PERF_TYPE_HW_CACHE, itlb_misses);
+        int err = errno;
+        int instr = open_counter(pid, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        if (itlb < 0 && i == 1)
+            fprintf(stderr, "[INFO] iTLB counter not available: %s\n", strerror(err));
+
+        double t0 = now_sec();
+        if (write(go[1], "x", 1) != 1)
+            return 1;
+        close(go[1]);
+        int status;
+        waitpid(pid, &status, 0);
+        double t1 = now_sec();
+
+        printf("%-32s %6d %10.1f", argv[i], WIFEXITED(status) ? WEXITSTATUS(status) : -1, (t1 - t0) * 1000);
+        print_count(itlb);
+        print_count(instr);
+        printf("\n");
+        if (itlb >= 0)
+            close(itlb);
+        if (instr >= 0)
+            close(instr);
+    }
+}
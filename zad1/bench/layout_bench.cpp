@@ -0,0 +1,76 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <signal.h>
+#include <string>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.hpp"
+
+/**
+ * Cost of patched binary's layout at exec time.
+ * For every binary prints number of VMAs right after execve (before
+ * dynamic loader runs) and mean/min latency of fork + execve + exit.
+ * Binaries should exit immediately in their `_start` (see layout_bench.sh).
+ *
+ * Usage: ./bench/layout_bench <runs> <binary>...
+ **/
+
+static pid_t spawn(const char* path, bool traced) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        if (traced)
+            ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+        execl(path, path, (char*) nullptr);
+        _exit(127);
+    }
+    return pid;
+}
+
+// -1 if process can't be stopped at exec (e.g. ptrace not permitted)
+static long count_vmas(const char* path) {
+    pid_t pid = spawn(path, true);
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFSTOPPED(status))
+        return -1;
+
+    std::ifstream maps("/proc/" + std::to_string(pid) + "/maps");
+    long res = 0;
+    std::string line;
+    while (std::getline(maps, line))
+        res++;
+
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    return res;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <runs> <binary>...\n", argv[0]);
+        return 1;
+    }
+    int runs = atoi(argv[1]);
+
+    printf("%-32s %6s %14s %14s\n", "binary", "VMAs", "mean [us]", "min [us]");
+    for (int i = 2; i < argc; i++) {
+        long vmas = count_vmas(argv[i]);
+
+        double sum = 0, min = 1e9;
+        for (int r = 0; r < runs; r++) {
+            double t0 = now_sec();
+            int status;
+            waitpid(spawn(argv[i], false), &status, 0);
+            double t = now_sec() - t0;
+            sum += t;
+            min = std::min(min, t);
+        }
+        printf("%-32s %6ld %14.1f %14.1f\n", argv[i], vmas, sum / runs * 1e6, min * 1e6);
+    }
+}
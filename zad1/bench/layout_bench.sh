@@ -0,0 +1,48 @@
+#!/bin/bash
+# VMA count and exec latency of binaries patched by two postlinker builds.
+# ET_REL has typical set of sections (.text.*, .rodata, .rodata.str*, .data, .bss)
+# and its `_start` exits at once, so latency is exec-to-`_start` cost.
+# Uses exec_call from z1/ (run `make` there first).
+#
+# Usage: ./bench/layout_bench.sh <postlinker before> [postlinker after] [runs, default 2000]
+
+if [ $# -lt 1 ]; then
+	echo "Usage: $0 <postlinker before> [postlinker after] [runs]" >&2
+	exit 1
+fi
+BEFORE=$(realpath "$1")
+DIR=$(realpath "$(dirname "$0")/..")
+AFTER=$(realpath "${2:-$DIR/postlinker}")
+RUNS=${3:-2000}
+OUT=$(mktemp -d)
+
+cat > "$OUT/rel.c" << 'EOF'
+const char table[64] = "read-only table";
+const char* msg = "string literal";
+int counter = 1;
+static char buf[64]; // bigger .bss needs NOBITS support in both builds
+
+void touch(void) {
+	counter += buf[0] + table[0] + msg[0];
+}
+
+void touch2(void) {
+	buf[1] = counter;
+}
+
+__asm__(
+	".global _start\n"
+	"_start:\n"
+	"mov $60, %eax\n"
+	"xor %edi, %edi\n"
+	"syscall\n"
+);
+EOF
+gcc -O1 -fno-common -ffunction-sections -fdata-sections -c -o "$OUT/rel.o" "$OUT/rel.c" || exit 1
+
+"$BEFORE" "$DIR/z1/exec_call" "$OUT/rel.o" "$OUT/before" > /dev/null || exit 1
+"$AFTER" "$DIR/z1/exec_call" "$OUT/rel.o" "$OUT/after" > /dev/null || exit 1
+
+"$DIR/bench/layout_bench" "$RUNS" "$DIR/z1/exec_call" "$OUT/before" "$OUT/after"
+
+rm -rf "$OUT"
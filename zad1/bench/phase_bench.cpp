@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "corpus.hpp"
+#include "../Linker.hpp"
+
+/**
+ * Time of each postlinker phase on synthetic corpus (see corpus.hpp), with
+ * one parameter scaled at a time: relocations, symbols, sections, ET_EXEC size
+ * (dense and sparse), threads resolving relocations (`--reloc-threads`).
+ * Median of `runs` runs is reported for each point, then scaling exponent
+ * k (time ~ x^k, from first and last point) of every phase of the series -
+ * for threads it is -1 when `relocs` phase scales perfectly.
+ *
+ * With --baseline, fails (exit 1) when phase of any point got slower than
+ * `tolerance` x baseline + `slack` ms. --save writes measured times as new
+ * baseline - times are machine specific, so it's saved on the same host first.
+ *
+ * Usage: ./bench/phase_bench [--runs N] [--baseline FILE] [--save FILE]
+ *        [--tolerance X] [--slack MS] [--series NAME]
+ **/
+
+struct point {
+    std::string series;
+    size_t x;
+    CorpusSpec spec;
+    size_t threads = 1;
+};
+
+static std::vector<point> corpus_points() {
+    std::vector<point> res;
+    for (size_t n : {1000, 10000, 100000}) {
+        CorpusSpec spec;
+        spec.relocs = n;
+        res.push_back({"relocs", n, spec});
+    }
+    for (size_t n : {1000, 10000, 100000}) {
+        CorpusSpec spec;
+        spec.symbols = n;
+        res.push_back({"symbols", n, spec});
+    }
+    for (size_t n : {4, 64, 1024}) {
+        CorpusSpec spec;
+        spec.sections = n;
+        spec.relocs = 4096;
+        res.push_back({"sections", n, spec});
+    }
+    for (size_t mb : {1, 16, 256}) {
+        CorpusSpec spec;
+        spec.exec_size = mb << 20;
+        res.push_back({"size_mb", mb, spec});
+    }
+    // GBs are written sparse - disk usage stays sane
+    for (size_t mb : {256, 4096}) {
+        CorpusSpec spec;
+        spec.exec_size = mb << 20;
+        spec.sparse = true;
+        res.push_back({"sparse_mb", mb, spec});
+    }
+    for (size_t n : {1, 2, 4, 8}) {
+        CorpusSpec spec;
+        spec.symbols = 10000;
+        spec.relocs = 400000;
+        res.push_back({"threads", n, spec, n});
+    }
+    return res;
+}
+
+static const char* const PHASES[] = {
+    "read", "gc", "icf", "merge", "layout", "append_sections", "add_moved_section_names", "phdrs",
+    "resolve_relocations", "overwrite_start", "detours", "dump", "total",
+};
+static const char* const SHORT[] = {
+    "read", "gc", "icf", "merge", "layout", "append", "names", "phdrs", "relocs", "start", "detours", "dump", "total",
+};
+static const size_t NUM_PHASES = sizeof(PHASES) / sizeof(PHASES[0]);
+
+using times = std::vector<double>; // ms, one per phase
+
+static double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    return v[v.size() / 2];
+}
+
+static times measure(const point& p, const std::string& dir, size_t runs) {
+    corpus_generate(p.spec, dir);
+    LinkJob job;
+    job.exec_fname = dir + "/exec";
+    job.rel_fnames = {dir + "/rel.o"};
+    job.out_fname = dir + "/out";
+    job.options.reloc_threads = p.threads;
+
+    std::vector<std::vector<double>> per_phase(NUM_PHASES);
+    for (size_t r = 0; r < runs; r++) {
+        double t0 = now_sec();
+        ExecInput exec(job.exec_fname);
+        double read_exec = now_sec() - t0;
+        LinkStats stats;
+        link(exec, job, &stats);
+        double total = now_sec() - t0;
+
+        // by name, phases missing in report count as 0
+        for (size_t i = 0; i + 1 < NUM_PHASES; i++) {
+            double ms = i == 0 ? read_exec * 1000 : 0;
+            for (const auto& phase : stats.phases) {
+                if (strcmp(phase.first, PHASES[i]) == 0)
+                    ms += phase.second * 1000;
+            }
+            per_phase[i].push_back(ms);
+        }
+        per_phase[NUM_PHASES - 1].push_back(total * 1000);
+    }
+    unlink(job.out_fname.c_str());
+    unlink(job.exec_fname.c_str());
+    unlink((dir + "/rel.o").c_str());
+
+    times res;
+    for (auto& v : per_phase)
+        res.push_back(median(v));
+    return res;
+}
+
+static std::string key(const point& p, size_t phase) {
+    return p.series + " " + std::to_string(p.x) + " " + PHASES[phase];
+}
+
+static std::map<std::string, double> load_baseline(const std::string& fname) {
+    std::map<std::string, double> res;
+    std::ifstream in(fname);
+    if (!in)
+        throw "cannot read " + fname;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream ss(line);
+        std::string series, x, phase;
+        double ms;
+        if (ss >> series >> x >> phase >> ms)
+            res[series + " " + x + " " + phase] = ms;
+    }
+    return res;
+}
+
+static void print_slopes(const std::vector<point>& pts, const std::vector<times>& res, size_t first, size_t last) {
+    printf("%-9s %10s", "", "k");
+    for (size_t i = 0; i < NUM_PHASES; i++) {
+        double a = res[first][i], b = res[last][i];
+        // too short to tell
+        if (a < 0.05 || b < 0.05)
+            printf(" %9s", "-");
+        else
+            printf(" %9.2f", std::log(b / a) / std::log((double) pts[last].x / pts[first].x));
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    size_t runs = 5;
+    std::string baseline, save, only;
+    double tolerance = 1.5, slack = 1.0;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--runs")
+            runs = std::max(1, atoi(argv[i + 1]));
+        else if (arg == "--baseline")
+            baseline = argv[i + 1];
+        else if (arg == "--save")
+            save = argv[i + 1];
+        else if (arg == "--tolerance")
+            tolerance = atof(argv[i + 1]);
+        else if (arg == "--slack")
+            slack = atof(argv[i + 1]);
+        else if (arg == "--series")
+            only = argv[i + 1];
+        else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    char dir[] = "/tmp/phase_bench.XXXXXX";
+    if (mkdtemp(dir) == nullptr) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    std::vector<point> pts;
+    for (auto& p : corpus_points()) {
+        if (only.empty() || p.series == only)
+            pts.push_back(p);
+    }
+
+    printf("%-9s %10s", "series", "x");
+    for (const char* name : SHORT)
+        printf(" %9s", name);
+    printf("   [ms, median of %zu]\n", runs);
+
+    std::vector<times> res;
+    size_t series_begin = 0;
+    try {
+        for (size_t k = 0; k < pts.size(); k++) {
+            res.push_back(measure(pts[k], dir, runs));
+            printf("%-9s %10zu", pts[k].series.c_str(), pts[k].x);
+            for (double ms : res.back())
+                printf(" %9.3f", ms);
+            printf("\n");
+            fflush(stdout);
+            if (k + 1 == pts.size() || pts[k + 1].series != pts[k].series) {
+                print_slopes(pts, res, series_begin, k);
+                series_begin = k + 1;
+            }
+        }
+    } catch (const std::string& err) {
+        fprintf(stderr, "%s\n", err.c_str());
+        rmdir(dir);
+        return 1;
+    }
+    rmdir(dir);
+
+    if (!save.empty()) {
+        std::ofstream out(save);
+        out << "# series x phase ms - written by phase_bench --save\n";
+        for (size_t k = 0; k < pts.size(); k++) {
+            for (size_t i = 0; i < NUM_PHASES; i++)
+                out << key(pts[k], i) << " " << res[k][i] << "\n";
+        }
+    }
+
+    if (baseline.empty())
+        return 0;
+    std::map<std::string, double> base;
+    try {
+        base = load_baseline(baseline);
+    } catch (const std::string& err) {
+        fprintf(stderr, "%s\n", err.c_str());
+        return 1;
+    }
+    int regressions = 0;
+    for (size_t k = 0; k < pts.size(); k++) {
+        for (size_t i = 0; i < NUM_PHASES; i++) {
+            auto it = base.find(key(pts[k], i));
+            if (it == base.end() || res[k][i] <= it->second * tolerance + slack)
+                continue;
+            printf("REGRESSION %s: %.3f ms, baseline %.3f ms\n", key(pts[k], i).c_str(), res[k][i], it->second);
+            regressions++;
+        }
+    }
+    printf("%s: %d regression(s) against %s (tolerance x%.2f + %.1f ms)\n",
+           regressions ? "FAIL" : "OK", regressions, baseline.c_str(), tolerance, slack);
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,52 @@
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#include "bench.hpp"
+#include "../ElfView.hpp"
+
+/**
+ * Compares read phase of postlinker: old istreambuf_iterator slurping
+ * (with copies done by `main`) against memory-mapped ElfView input.
+ *
+ * Usage: ./bench/read_bench <ET_EXEC file> <ET_REL file>
+ **/
+
+static volatile size_t sink;
+
+static std::string slurp(const std::string& fname) {
+    std::ifstream in{fname};
+    return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::cerr << "Usage: ./bench/read_bench <ET_EXEC file> <ET_REL file>\n";
+        return 1;
+    }
+    std::string exec_fname = argv[1], rel_fname = argv[2];
+
+    run_isolated("istreambuf (old)", [&]() {
+        auto pair = std::make_pair(slurp(exec_fname), slurp(rel_fname));
+        std::string exec_content = pair.first;
+        std::string rel_content = pair.second;
+        sink = exec_content.size() + rel_content.size();
+    });
+
+    run_isolated("ElfView", [&]() {
+        ElfView exec_bin{exec_fname, MADV_SEQUENTIAL};
+        ElfView rel_bin{rel_fname, MADV_WILLNEED};
+        std::string exec_content(exec_bin.view()); // output buffer
+        sink = exec_content.size() + rel_bin.size();
+    });
+
+    run_isolated("ElfView (no copy)", [&]() {
+        ElfView exec_bin{exec_fname, MADV_SEQUENTIAL};
+        ElfView rel_bin{rel_fname, MADV_WILLNEED};
+        size_t sum = 0;
+        for (size_t i = 0; i < exec_bin.size(); i += 4096)
+            sum += exec_bin.data()[i];
+        sink = sum + rel_bin.size();
+    });
+}
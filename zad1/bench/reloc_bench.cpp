@@ -0,0 +1,72 @@
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+
+#include "bench.hpp"
+#include "synth.hpp"
+#include "../ElfImage.hpp"
+#include "../Relocator.hpp"
+
+/**
+ * Time per relocation against ET_EXEC size: stringstream rewrite of whole
+ * file (the old execute_relocation) against in-place Relocator.
+ *
+ * Usage: ./bench/reloc_bench
+ **/
+
+static void old_execute_relocation(std::string& content, size_t rel_val, size_t offset, bool rel64 = false) {
+    std::stringstream ss;
+    size_t num = rel64 ? 8 : 4;
+    ss << content.substr(0, offset);
+    ss.write((const char *) &rel_val, num);
+    ss << content.substr(offset + num, std::string::npos);
+    content.clear();
+    content = ss.str();
+}
+
+int main() {
+    const size_t sizes_mb[] = {1, 16, 64, 256};
+    const size_t num_relas = 100000;
+    const double old_budget = 2e9; // bytes copied by old way at most
+
+    printf("%10s %10s %18s %18s\n", "size [MB]", "relas", "old [us/rela]", "Relocator [ns/rela]");
+    for (size_t mb : sizes_mb) {
+        const size_t base = 0x600000;
+        SynthElf elf;
+        size_t data = elf.add_section(".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, std::string(mb << 20, '\0'), base, 0x1000);
+        elf.add_load(data);
+        ElfImage exec{elf.build()};
+
+        std::mt19937_64 gen(mb);
+        std::vector<rela_descr> relas;
+        for (size_t i = 0; i < num_relas; i++) {
+            rela_descr r{};
+            bool pc = i % 2;
+            r.hdr.r_info = ELF64_R_INFO(0, pc ? R_X86_64_PC32 : R_X86_64_64);
+            r.vaddr = base + gen() % ((mb << 20) - 8);
+            r.symbol.first.st_value = base + gen() % (mb << 20);
+            relas.push_back(r);
+        }
+
+        size_t num_old = std::min<size_t>(num_relas, old_budget / exec.size());
+        std::string content = exec.copy(0, exec.size());
+        Relocator relocator(exec);
+        double t0 = now_sec();
+        for (size_t i = 0; i < num_old; i++) {
+            const rela_descr& r = relas[i];
+            bool pc = ELF64_R_TYPE(r.hdr.r_info) == R_X86_64_PC32;
+            old_execute_relocation(content, r.symbol.first.st_value - (pc ? r.vaddr : 0), relocator.vaddr2off(r.vaddr), !pc);
+        }
+        double t1 = now_sec();
+
+        Relocator fresh(exec); // old way reallocated buffer
+        double t2 = now_sec();
+        for (const rela_descr& r : relas)
+            fresh.apply(r);
+        double t3 = now_sec();
+
+        printf("%10zu %10zu %18.3f %18.3f\n", mb, num_relas,
+               (t1 - t0) * 1e6 / num_old, (t3 - t2) * 1e9 / num_relas);
+    }
+}
@@ -0,0 +1,64 @@
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "bench.hpp"
+#include "synth.hpp"
+#include "../ElfImage.hpp"
+#include "../SymbolIndex.hpp"
+
+/**
+ * Symbol resolution scaling: linear scan over get_symbols() per relocation
+ * (the old find_corresponding_symbol) against SymbolIndex built once.
+ *
+ * Usage: ./bench/symbol_bench
+ **/
+
+static volatile size_t sink;
+
+// the old way - whole .symtab rebuilt and scanned for every lookup
+static size_t linear_lookup(const ElfImage& img, const std::string& name) {
+    auto symbols = get_symbols(img);
+    for (size_t i = 0; i < symbols.size(); i++) {
+        if (symbols[i].second == name)
+            return i;
+    }
+    return -1;
+}
+
+int main() {
+    const size_t sym_counts[] = {1000, 10000, 100000, 400000};
+    const size_t rela_counts[] = {100, 1000, 5000};
+    const double linear_budget = 5e7; // symbols x relocations done by linear scan at most
+
+    printf("%10s %10s %16s %16s %16s\n", "symbols", "relas", "linear [ms]", "index build[ms]", "index find [ms]");
+    for (size_t num_syms : sym_counts) {
+        ElfImage img{synth_symtab_elf(num_syms)};
+        for (size_t num_relas : rela_counts) {
+            std::mt19937 gen(num_syms ^ num_relas);
+            std::vector<std::string> wanted;
+            for (size_t i = 0; i < num_relas; i++)
+                wanted.push_back("sym_" + std::to_string(gen() % num_syms));
+
+            double linear = -1;
+            if ((double) num_syms * num_relas <= linear_budget) {
+                double t0 = now_sec();
+                for (const auto& name : wanted)
+                    sink = linear_lookup(img, name);
+                linear = (now_sec() - t0) * 1000;
+            }
+
+            double t0 = now_sec();
+            SymbolIndex idx(img);
+            double t1 = now_sec();
+            for (const auto& name : wanted)
+                sink = idx.find(name);
+            double t2 = now_sec();
+
+            if (linear < 0)
+                printf("%10zu %10zu %16s %16.3f %16.3f\n", num_syms, num_relas, "(skipped)", (t1 - t0) * 1000, (t2 - t1) * 1000);
+            else
+                printf("%10zu %10zu %16.3f %16.3f %16.3f\n", num_syms, num_relas, linear, (t1 - t0) * 1000, (t2 - t1) * 1000);
+        }
+    }
+}
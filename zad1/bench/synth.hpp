@@ -0,0 +1,139 @@
+#pragma once
+
+#include <elf.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/**
+ * Builder of synthetic ELF files for benchmarks.
+ * Layout: ELF header, program headers, sections (in order of adding),
+ * .shstrtab, section header table.
+ **/
+struct SynthElf {
+    Elf64_Half type = ET_EXEC;
+    std::vector<Elf64_Shdr> shdrs = std::vector<Elf64_Shdr>(1, Elf64_Shdr{});
+    std::vector<std::string> names = std::vector<std::string>(1);
+    std::vector<std::string> contents = std::vector<std::string>(1);
+    std::vector<size_t> loads; // indices of sections that get own PT_LOAD
+
+    size_t add_section(const std::string& name, Elf64_Word sh_type, Elf64_Xword flags, std::string content,
+                       Elf64_Addr addr = 0, Elf64_Xword align = 1, Elf64_Word link = 0, Elf64_Word info = 0,
+                       Elf64_Xword entsize = 0) {
+        Elf64_Shdr shdr{};
+        shdr.sh_type = sh_type;
+        shdr.sh_flags = flags;
+        shdr.sh_addr = addr;
+        shdr.sh_size = content.size();
+        shdr.sh_link = link;
+        shdr.sh_info = info;
+        shdr.sh_addralign = align;
+        shdr.sh_entsize = entsize;
+        shdrs.push_back(shdr);
+        names.push_back(name);
+        contents.push_back(std::move(content));
+        return shdrs.size() - 1;
+    }
+
+    /**
+     * PT_LOAD mapping `idx` section at its sh_addr (which must be congruent with
+     * page-aligned file offset chosen by `build`).
+     **/
+    void add_load(size_t idx) { loads.push_back(idx); }
+
+    std::string build() {
+        std::string shstrtab(1, '\0');
+        for (size_t i = 1; i < shdrs.size(); i++) {
+            shdrs[i].sh_name = shstrtab.size();
+            shstrtab += names[i];
+            shstrtab.push_back('\0');
+        }
+        Elf64_Shdr shstrtab_hdr{};
+        shstrtab_hdr.sh_name = shstrtab.size();
+        shstrtab += ".shstrtab";
+        shstrtab.push_back('\0');
+        shstrtab_hdr.sh_type = SHT_STRTAB;
+        shstrtab_hdr.sh_addralign = 1;
+
+        Elf64_Ehdr ehdr{};
+        memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+        ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+        ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+        ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+        ehdr.e_type = type;
+        ehdr.e_machine = EM_X86_64;
+        ehdr.e_version = EV_CURRENT;
+        ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+        ehdr.e_phentsize = sizeof(Elf64_Phdr);
+        ehdr.e_shentsize = sizeof(Elf64_Shdr);
+        ehdr.e_phoff = loads.empty() ? 0 : sizeof(Elf64_Ehdr);
+        ehdr.e_phnum = loads.size();
+        ehdr.e_shnum = shdrs.size() + 1;
+        ehdr.e_shstrndx = shdrs.size();
+
+        std::string content(sizeof(Elf64_Ehdr) + loads.size() * sizeof(Elf64_Phdr), '\0');
+        for (size_t i = 1; i < shdrs.size(); i++) {
+            bool is_load = std::find(loads.begin(), loads.end(), i) != loads.end();
+            size_t align = is_load ? 0x1000 : std::max<size_t>(shdrs[i].sh_addralign, 1);
+            content.resize((content.size() + align - 1) / align * align, '\0');
+            shdrs[i].sh_offset = content.size();
+            if (shdrs[i].sh_type != SHT_NOBITS)
+                content += contents[i];
+        }
+        shstrtab_hdr.sh_offset = content.size();
+        shstrtab_hdr.sh_size = shstrtab.size();
+        content += shstrtab;
+
+        content.resize((content.size() + 7) / 8 * 8, '\0');
+        ehdr.e_shoff = content.size();
+        for (const auto& shdr : shdrs)
+            content.append((const char*) &shdr, sizeof(shdr));
+        content.append((const char*) &shstrtab_hdr, sizeof(shstrtab_hdr));
+
+        for (size_t i = 0; i < loads.size(); i++) {
+            const Elf64_Shdr& s = shdrs[loads[i]];
+            Elf64_Phdr ph{};
+            ph.p_type = PT_LOAD;
+            ph.p_flags = PF_R | (s.sh_flags & SHF_WRITE ? PF_W : 0) | (s.sh_flags & SHF_EXECINSTR ? PF_X : 0);
+            ph.p_offset = s.sh_offset;
+            ph.p_vaddr = ph.p_paddr = s.sh_addr;
+            ph.p_filesz = s.sh_type == SHT_NOBITS ? 0 : s.sh_size;
+            ph.p_memsz = s.sh_size;
+            ph.p_align = 0x1000;
+            memcpy(&content[ehdr.e_phoff + i * sizeof(Elf64_Phdr)], &ph, sizeof(ph));
+        }
+        memcpy(&content[0], &ehdr, sizeof(ehdr));
+        return content;
+    }
+};
+
+/**
+ * Symbols are named `sym_0`, `sym_1`...
+ **/
+inline void synth_add_symtab(SynthElf& elf, size_t num_syms) {
+    std::string strtab(1, '\0');
+    std::string symtab(sizeof(Elf64_Sym), '\0'); // null symbol
+    for (size_t i = 0; i < num_syms; i++) {
+        Elf64_Sym sym{};
+        sym.st_name = strtab.size();
+        sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+        sym.st_shndx = SHN_ABS;
+        sym.st_value = 0x401000 + 16 * i;
+        strtab += "sym_" + std::to_string(i);
+        strtab.push_back('\0');
+        symtab.append((const char*) &sym, sizeof(sym));
+    }
+    size_t strtab_idx = elf.shdrs.size() + 1;
+    elf.add_section(".symtab", SHT_SYMTAB, 0, symtab, 0, 8, strtab_idx, 1, sizeof(Elf64_Sym));
+    elf.add_section(".strtab", SHT_STRTAB, 0, strtab);
+}
+
+/**
+ * Minimal ELF with .symtab, .strtab and .shstrtab only.
+ **/
+inline std::string synth_symtab_elf(size_t num_syms) {
+    SynthElf elf;
+    synth_add_symtab(elf, num_syms);
+    return elf.build();
+}